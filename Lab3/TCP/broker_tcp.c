@@ -1,3 +1,6 @@
+// Compilar: gcc broker_tcp.c -o broker_tcp -llz4 -lzstd
+// Uso: ./broker_tcp [msgs/s por publisher] [msgs/s por topic]
+
 #include <stdio.h>          // Librería estándar de entrada y salida
 #include <stdlib.h>         // Librería para funciones generales (malloc, exit, etc.)
 #include <string.h>         // Librería para manejo de cadenas (strcmp, strcpy, etc.)
@@ -5,35 +8,788 @@
 #include <arpa/inet.h>      // Define estructuras y funciones para manejo de direcciones IP (inet_ntoa, htons, etc.)
 #include <sys/select.h>     // Permite el uso de select(), que monitorea múltiples sockets a la vez
 #include <errno.h>          // Permite manejar errores del sistema mediante la variable global errno
+#include <math.h>           // HUGE_VAL para los rangos numéricos abiertos de los filtros
+#include <time.h>           // clock_gettime() para recargar las cubetas de tokens
+#include <lz4.h>            // Compresión rápida negociada por publishers y suscriptores
+#include <zstd.h>           // Compresión zstd con diccionario por topic
+#include <zdict.h>          // Entrenamiento de los diccionarios zstd
 
 #define PORT 5050
 #define MAX_CLIENTS 20
 #define BUFFER_SIZE 1024
 #define MAX_TOPICS 10
+#define MAX_FILTROS 32         // Filtros distintos compilados (el índice 0 significa "sin filtro")
+#define MAX_FILTRO_LEN 256
+#define MAX_CONDICIONES 8
+#define MAX_CLAVE 32
+#define MAX_VALOR 64
+#define MAX_CAMPOS 32
+#define FRAME_SIZE (BUFFER_SIZE + 64) // Mensaje + cabecera de un frame comprimido
+#define MUESTRAS_DICT 64              // Mensajes de muestra para entrenar el diccionario de un topic
+#define MUESTRAS_SIZE 16384
+#define DICT_CAP 1024
+#define ZSTD_NIVEL 3
+#define TASA_PUBLISHER 50.0        // Mensajes por segundo por publisher (modificable por argumento)
+#define TASA_TOPIC 200.0           // Mensajes por segundo por topic (modificable por argumento)
+#define RAFAGA_SEG 1.0             // Una cubeta llena acumula RAFAGA_SEG segundos de mensajes
+#define COLA_LEN 16                // Mensajes pendientes por topic
+#define QUANTUM_CONEXION 256       // Bytes que gana cada publisher por ronda al leer
+#define QUANTUM_TOPIC 1500         // Bytes que gana cada topic por ronda al reenviar
+#define ESPERA_COLAS_US 1000       // Con trabajo pendiente select() solo espera esto
+#define ESTADISTICAS_SEG 10
+#define ENTRADA_SIZE (2 * FRAME_SIZE) // Buffer de recepción de cada conexión
+#define MAX_CABECERA 64
+
+// Compresión negociada en el PUB ("@lz4") o en el SUB ("@lz4" o "@zstd")
+enum { CODEC_NINGUNO, CODEC_LZ4, CODEC_ZSTD };
+
+// Cubeta de tokens: se recarga a "tasa" tokens por segundo y cada mensaje consume uno
+struct Cubeta {
+    double tokens;
+    double ultimo;                // Instante de la última recarga, 0 = cubeta nueva (llena)
+};
+
+// Mensaje leído de un publisher que espera turno en la cola de su topic
+struct Mensaje {
+    int origen;                   // Socket del publisher (no se le reenvía su propio mensaje)
+    int len;
+    char texto[BUFFER_SIZE];
+    char lz4[BUFFER_SIZE];        // Bloque lz4 tal como lo envió el publisher (si lo hizo)
+    size_t lz4_len;
+};
 
 // Estructura para manejar suscriptores asociados a un "topic" (tema)
 struct Topic {
     char name[50];
     int subscribers[MAX_CLIENTS]; // Guarda los descriptores de socket de cada suscriptor
+    int filtros[MAX_CLIENTS];     // Filtro de cada suscriptor (índice en filtros[], 0 = recibe todo)
+    int codecs[MAX_CLIENTS];      // Compresión de cada suscriptor (CODEC_*)
+
+    // Diccionario zstd del topic, entrenado con los primeros mensajes publicados
+    char muestras[MUESTRAS_SIZE];
+    size_t muestra_len[MUESTRAS_DICT];
+    int n_muestras;
+    size_t muestras_usado;
+    char dict[DICT_CAP];
+    size_t dict_len;
+    unsigned dict_id;             // 0 = todavía no hay diccionario
+    ZSTD_CDict *cdict;
+
+    // Cola de mensajes pendientes, atendida por deficit round robin
+    struct Mensaje cola[COLA_LEN];
+    int cola_ini, cola_n;
+    long deficit;
+    struct Cubeta cubeta;         // Límite de mensajes por segundo del topic
+    unsigned long servidos, rondas_sin_tokens;
+};
+
+// FILTROS DE CONTENIDO
+// Un SUB puede incluir una expresión "cond1,cond2,..." que se evalúa sobre los
+// campos clave=valor del mensaje; deben cumplirse todas las condiciones:
+//   clave=valor     igualdad exacta
+//   clave^=prefijo  el valor empieza por el prefijo
+//   clave=min..max  rango numérico inclusivo (min o max pueden omitirse)
+// Cada expresión distinta se compila una sola vez y la comparten los suscriptores que la usan.
+enum { COND_IGUAL, COND_PREFIJO, COND_RANGO };
+
+struct Condicion {
+    char clave[MAX_CLAVE];
+    size_t clave_len;
+    int op;
+    char valor[MAX_VALOR];
+    size_t valor_len;
+    double min, max;
+};
+
+struct Filtro {
+    char expr[MAX_FILTRO_LEN];     // Expresión original, permite compartir filtros idénticos
+    struct Condicion conds[MAX_CONDICIONES];
+    int n;
+    int refs;                      // Suscripciones que lo usan; 0 = posición libre
+};
+
+// Campo clave=valor del mensaje (apunta dentro del buffer, no se copia)
+struct Campo {
+    const char *clave;
+    size_t clave_len;
+    const char *valor;
+    size_t valor_len;
+    double num;
+    int es_num;
 };
 
+struct Filtro filtros[MAX_FILTROS];
+
+// Compila una condición (s, len) sin terminador; devuelve -1 si es inválida
+int compilar_condicion(const char *s, size_t len, struct Condicion *c) {
+    const char *eq = memchr(s, '=', len);
+    if (eq == NULL || eq == s)
+        return -1;
+
+    size_t klen = eq - s;
+    c->op = COND_IGUAL;
+    if (s[klen - 1] == '^') {
+        c->op = COND_PREFIJO;
+        if (--klen == 0)
+            return -1;
+    }
+    size_t vlen = len - (eq + 1 - s);
+    if (klen >= MAX_CLAVE || vlen >= MAX_VALOR)
+        return -1;
+
+    memcpy(c->clave, s, klen);
+    c->clave[klen] = '\0';
+    c->clave_len = klen;
+    memcpy(c->valor, eq + 1, vlen);
+    c->valor[vlen] = '\0';
+    c->valor_len = vlen;
+
+    // "min..max" convierte la igualdad en un rango numérico
+    char *dots = strstr(c->valor, "..");
+    if (c->op == COND_IGUAL && dots != NULL) {
+        char *end;
+        c->min = -HUGE_VAL;
+        c->max = HUGE_VAL;
+        *dots = '\0'; // strtod("10..30") leería "10." y consumiría uno de los puntos
+        if (dots != c->valor) {
+            c->min = strtod(c->valor, &end);
+            if (*end != '\0')
+                return -1;
+        }
+        if (dots[2] != '\0') {
+            c->max = strtod(dots + 2, &end);
+            if (*end != '\0')
+                return -1;
+        }
+        c->op = COND_RANGO;
+    }
+    return 0;
+}
+
+// Devuelve el índice del filtro compilado para expr, reutilizando uno idéntico si ya existe.
+// Devuelve -1 si la expresión es inválida o no quedan posiciones libres.
+int obtener_filtro(const char *expr) {
+    if (strlen(expr) >= MAX_FILTRO_LEN)
+        return -1;
+
+    int libre = 0;
+    for (int f = 1; f < MAX_FILTROS; f++) {
+        if (filtros[f].refs > 0) {
+            if (strcmp(filtros[f].expr, expr) == 0) {
+                filtros[f].refs++;
+                return f;
+            }
+        } else if (libre == 0) {
+            libre = f;
+        }
+    }
+    if (libre == 0) {
+        fprintf(stderr, "Tabla de filtros llena\n");
+        return -1;
+    }
+
+    struct Filtro *fl = &filtros[libre];
+    fl->n = 0;
+    for (const char *s = expr; *s != '\0';) {
+        size_t len = strcspn(s, ",");
+        if (len > 0) {
+            if (fl->n == MAX_CONDICIONES || compilar_condicion(s, len, &fl->conds[fl->n]) < 0)
+                return -1;
+            fl->n++;
+        }
+        s += len;
+        if (*s == ',')
+            s++;
+    }
+    if (fl->n == 0)
+        return -1;
+
+    strcpy(fl->expr, expr);
+    fl->refs = 1;
+    return libre;
+}
+
+void liberar_filtro(int f) {
+    if (f > 0 && filtros[f].refs > 0)
+        filtros[f].refs--;
+}
+
+// Separa el mensaje en campos clave=valor (las palabras sin '=' se ignoran)
+int extraer_campos(const char *msg, struct Campo *campos, int max) {
+    int n = 0;
+    const char *p = msg;
+    while (*p != '\0' && n < max) {
+        p += strspn(p, " \t\r\n");
+        size_t len = strcspn(p, " \t\r\n");
+        const char *eq = memchr(p, '=', len);
+        if (eq != NULL && eq != p) {
+            struct Campo *c = &campos[n++];
+            c->clave = p;
+            c->clave_len = eq - p;
+            c->valor = eq + 1;
+            c->valor_len = len - (eq + 1 - p);
+
+            // El valor numérico se calcula una vez por mensaje, no una vez por filtro
+            char num[MAX_VALOR];
+            char *end;
+            c->es_num = 0;
+            if (c->valor_len > 0 && c->valor_len < sizeof(num)) {
+                memcpy(num, c->valor, c->valor_len);
+                num[c->valor_len] = '\0';
+                c->num = strtod(num, &end);
+                c->es_num = (*end == '\0');
+            }
+        }
+        p += len;
+    }
+    return n;
+}
+
+// Devuelve 1 si cada condición del filtro se cumple en algún campo del mensaje
+int evaluar_filtro(const struct Filtro *f, const struct Campo *campos, int n) {
+    for (int k = 0; k < f->n; k++) {
+        const struct Condicion *c = &f->conds[k];
+        int ok = 0;
+        for (int i = 0; i < n && !ok; i++) {
+            const struct Campo *cp = &campos[i];
+            if (cp->clave_len != c->clave_len || memcmp(cp->clave, c->clave, c->clave_len) != 0)
+                continue;
+            switch (c->op) {
+            case COND_IGUAL:
+                ok = cp->valor_len == c->valor_len && memcmp(cp->valor, c->valor, c->valor_len) == 0;
+                break;
+            case COND_PREFIJO:
+                ok = cp->valor_len >= c->valor_len && memcmp(cp->valor, c->valor, c->valor_len) == 0;
+                break;
+            case COND_RANGO:
+                ok = cp->es_num && cp->num >= c->min && cp->num <= c->max;
+                break;
+            }
+        }
+        if (!ok)
+            return 0;
+    }
+    return 1;
+}
+
+// COMPRESIÓN
+// Con compresión negociada los mensajes viajan como frames "<cabecera>\n<datos>":
+//   RAW <len>                      sin comprimir (comprimir no ahorraba bytes)
+//   LZ4 <rawlen> <len>             bloque lz4
+//   ZST <dict_id> <rawlen> <len>   frame zstd, dict_id 0 = sin diccionario
+//   DIC <dict_id> <len>            diccionario zstd del topic
+// El último número de la cabecera siempre es el largo de los datos, lo que además
+// delimita los mensajes dentro del flujo TCP. Cada frame se arma una sola vez por
+// mensaje y se envía igual a todos los suscriptores con el mismo codec.
+// Las líneas de registro ("PUB:..." y "SUB:...") terminan en '\n'.
+unsigned ultimo_dict_id = 0;
+ZSTD_CCtx *zstd_cctx = NULL;
+
+// Arma un frame con cabecera y datos (ya comprimidos o crudos); devuelve su tamaño
+size_t armar_frame(char *out, const char *cabecera, const char *datos, size_t len) {
+    size_t h = strlen(cabecera);
+    memcpy(out, cabecera, h);
+    memcpy(out + h, datos, len);
+    return h + len;
+}
+
+// Comprime msg con el codec dado; si no se ahorran bytes se envía como RAW
+size_t comprimir_frame(char *out, int codec, const struct Topic *t, const char *msg, size_t len) {
+    char comp[BUFFER_SIZE];
+    char cabecera[64];
+    size_t clen = 0;
+
+    // Capacidad len - 1: si el resultado no cabe, comprimir no vale la pena
+    if (codec == CODEC_LZ4) {
+        int r = LZ4_compress_default(msg, comp, (int)len, (int)len - 1);
+        if (r > 0)
+            clen = r;
+        snprintf(cabecera, sizeof(cabecera), "LZ4 %zu %zu\n", len, clen);
+    } else {
+        if (zstd_cctx == NULL)
+            zstd_cctx = ZSTD_createCCtx();
+        size_t r = (t->cdict != NULL)
+            ? ZSTD_compress_usingCDict(zstd_cctx, comp, len - 1, msg, len, t->cdict)
+            : ZSTD_compressCCtx(zstd_cctx, comp, len - 1, msg, len, ZSTD_NIVEL);
+        if (!ZSTD_isError(r))
+            clen = r;
+        snprintf(cabecera, sizeof(cabecera), "ZST %u %zu %zu\n", t->dict_id, len, clen);
+    }
+
+    if (clen == 0) {
+        snprintf(cabecera, sizeof(cabecera), "RAW %zu\n", len);
+        return armar_frame(out, cabecera, msg, len);
+    }
+    return armar_frame(out, cabecera, comp, clen);
+}
+
+void enviar_diccionario(int dest, const struct Topic *t) {
+    char frame[FRAME_SIZE];
+    char cabecera[64];
+    snprintf(cabecera, sizeof(cabecera), "DIC %u %zu\n", t->dict_id, t->dict_len);
+    send(dest, frame, armar_frame(frame, cabecera, t->dict, t->dict_len), 0);
+}
+
+// Guarda msg como muestra del topic; con suficientes muestras entrena el diccionario zstd
+// y lo envía a los suscriptores zstd del topic
+void muestrear(struct Topic *t, const char *msg, size_t len) {
+    if (t->cdict != NULL)
+        return;
+
+    if (t->n_muestras < MUESTRAS_DICT && t->muestras_usado + len <= MUESTRAS_SIZE) {
+        memcpy(t->muestras + t->muestras_usado, msg, len);
+        t->muestras_usado += len;
+        t->muestra_len[t->n_muestras++] = len;
+        if (t->n_muestras < MUESTRAS_DICT)
+            return;
+    }
+
+    size_t r = ZDICT_trainFromBuffer(t->dict, DICT_CAP, t->muestras, t->muestra_len, (unsigned)t->n_muestras);
+    t->n_muestras = 0;
+    t->muestras_usado = 0;
+    if (ZDICT_isError(r)) {
+        // Se vuelve a intentar con el siguiente lote de muestras
+        fprintf(stderr, "No se pudo entrenar el diccionario de '%s': %s\n", t->name, ZDICT_getErrorName(r));
+        return;
+    }
+    t->dict_len = r;
+    t->cdict = ZSTD_createCDict(t->dict, t->dict_len, ZSTD_NIVEL);
+    t->dict_id = ++ultimo_dict_id;
+    printf("Diccionario zstd %u para topic '%s' (%zu bytes)\n", t->dict_id, t->name, t->dict_len);
+
+    for (int s = 0; s < MAX_CLIENTS; s++) {
+        if (t->subscribers[s] != 0 && t->codecs[s] == CODEC_ZSTD)
+            enviar_diccionario(t->subscribers[s], t);
+    }
+}
+
 // Estructura para los publishers
 struct Publisher {
     int socket;      // Descriptor de socket del publicador
     char topic[50];  // Nombre del tema que publica
+    int codec;       // CODEC_LZ4 si envía frames comprimidos
+    int t;           // Índice del topic en topics[] (su cola), -1 si no hay lugar
+
+    // Límite de tasa y turno de lectura (deficit round robin entre conexiones)
+    struct Cubeta cubeta;
+    double frenado_hasta;         // Sin tokens: sus mensajes esperan hasta este instante
+    long deficit;
+    unsigned long admitidos, limitados, bytes;
+    unsigned long descartados;    // Sin lugar en la tabla de topics: no hay cola donde dejarlos
 };
 
-int main() {
+// Buffer de recepción de cada conexión. read() agrega lo que llegue y solo se procesan
+// unidades completas (una línea o un frame), así un cliente que envía medio frame no
+// bloquea al broker: simplemente espera a que llegue el resto.
+// Los clientes anteriores a las líneas con '\n' envían "SUB:futbol" o el mensaje sin
+// delimitador: si la primera lectura de una conexión no trae '\n', cada read() de esa
+// conexión se toma como una unidad, igual que antes.
+enum { ENTRADA_NUEVA, ENTRADA_LINEAS, ENTRADA_LECTURAS };
+
+struct Conexion {
+    char entrada[ENTRADA_SIZE];
+    size_t len;
+    int modo;        // ENTRADA_*: se decide con la primera lectura
+    int eof;         // El cliente cerró su lado: se procesa lo que quede y se cierra
+    int bloqueado;   // Tiene mensajes completos esperando turno, tokens o lugar en la cola
+};
+
+// LÍMITES DE TASA Y PLANIFICACIÓN
+// Cada publisher y cada topic tienen una cubeta de tokens. Los mensajes de un publisher
+// sin tokens, o con la cola de su topic llena, se quedan en su buffer de recepción; si el
+// buffer se llena el socket deja de leerse y TCP frena al emisor por control de flujo. Las conexiones
+// se recorren desde un inicio rotativo y con deficit round robin por bytes, así que
+// los índices bajos de client_sockets[] ya no tienen prioridad. Las colas de los topics
+// también se atienden con deficit round robin: un topic ruidoso retrasa como mucho
+// una ronda a los demás.
+double tasa_publisher = TASA_PUBLISHER;
+double tasa_topic = TASA_TOPIC;
+int hubo_actividad = 0;           // Para no imprimir estadísticas repetidas
+
+double ahora_seg(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void recargar(struct Cubeta *c, double tasa, double ahora) {
+    double max = (tasa * RAFAGA_SEG < 1.0) ? 1.0 : tasa * RAFAGA_SEG;
+    c->tokens = (c->ultimo == 0) ? max : c->tokens + (ahora - c->ultimo) * tasa;
+    if (c->tokens > max)
+        c->tokens = max;
+    c->ultimo = ahora;
+}
+
+// Reenvía un mensaje a los suscriptores del topic cuyo filtro lo acepte.
+// Cada filtro distinto se evalúa como máximo una vez por mensaje, y cada frame
+// comprimido también se arma como máximo una vez por mensaje.
+void reenviar_mensaje(struct Topic *t, const struct Mensaje *m) {
+    struct Campo campos[MAX_CAMPOS];
+    int n_campos = -1;
+    signed char resultado[MAX_FILTROS];
+    memset(resultado, -1, sizeof(resultado));
+    char frames[3][FRAME_SIZE];
+    size_t frame_len[3] = {0, 0, 0};
+    int hay_zstd = 0;
+
+    for (int s = 0; s < MAX_CLIENTS; s++) {
+        int dest = t->subscribers[s];
+        int f = t->filtros[s];
+        if (dest != 0 && f != 0) {
+            if (resultado[f] < 0) {
+                if (n_campos < 0)
+                    n_campos = extraer_campos(m->texto, campos, MAX_CAMPOS);
+                resultado[f] = evaluar_filtro(&filtros[f], campos, n_campos);
+            }
+            if (!resultado[f])
+                continue;
+        }
+        if (dest != 0 && dest != m->origen) {
+            int codec = t->codecs[s];
+            if (codec == CODEC_NINGUNO) {
+                // send(): envía los datos al socket destino
+                send(dest, m->texto, strlen(m->texto), 0);
+                continue;
+            }
+            if (frame_len[codec] == 0) {
+                if (codec == CODEC_LZ4 && m->lz4_len > 0) {
+                    char cabecera[64];
+                    snprintf(cabecera, sizeof(cabecera), "LZ4 %d %zu\n", m->len, m->lz4_len);
+                    frame_len[codec] = armar_frame(frames[codec], cabecera, m->lz4, m->lz4_len);
+                } else {
+                    frame_len[codec] = comprimir_frame(frames[codec], codec, t, m->texto, m->len);
+                }
+            }
+            hay_zstd |= (codec == CODEC_ZSTD);
+            send(dest, frames[codec], frame_len[codec], 0);
+        }
+    }
+    // El diccionario solo se entrena para topics con suscriptores zstd
+    if (hay_zstd)
+        muestrear(t, m->texto, m->len);
+
+    printf("[%s] %s\n", t->name, m->texto);
+}
+
+// Una ronda de deficit round robin sobre las colas de los topics
+void servir_colas(struct Topic *topics) {
+    static int inicio = 0;
+    double ahora = ahora_seg();
+    for (int k = 0; k < MAX_TOPICS; k++) {
+        struct Topic *t = &topics[(inicio + k) % MAX_TOPICS];
+        if (t->cola_n == 0)
+            continue;
+
+        recargar(&t->cubeta, tasa_topic, ahora);
+        if (t->cubeta.tokens < 1) {
+            // El topic superó su tasa: pierde la ronda sin acumular déficit
+            t->rondas_sin_tokens++;
+            continue;
+        }
+        t->deficit += QUANTUM_TOPIC;
+        while (t->cola_n > 0 && t->cola[t->cola_ini].len <= t->deficit && t->cubeta.tokens >= 1) {
+            const struct Mensaje *m = &t->cola[t->cola_ini];
+            t->deficit -= m->len;
+            t->cubeta.tokens -= 1;
+            t->servidos++;
+            reenviar_mensaje(t, m);
+            t->cola_ini = (t->cola_ini + 1) % COLA_LEN;
+            t->cola_n--;
+        }
+        // Una cola vacía no guarda déficit para la ronda siguiente
+        if (t->cola_n == 0)
+            t->deficit = 0;
+    }
+    inicio = (inicio + 1) % MAX_TOPICS;
+}
+
+void imprimir_estadisticas(const struct Topic *topics, const struct Publisher *publishers) {
+    printf("--- Estadísticas (límites: %.1f msgs/s por publisher, %.1f msgs/s por topic) ---\n",
+           tasa_publisher, tasa_topic);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (publishers[i].socket != 0)
+            printf("  publisher socket %d topic '%s': admitidos=%lu bytes=%lu limitados=%lu descartados=%lu\n",
+                   publishers[i].socket, publishers[i].topic, publishers[i].admitidos,
+                   publishers[i].bytes, publishers[i].limitados, publishers[i].descartados);
+    }
+    for (int t = 0; t < MAX_TOPICS; t++) {
+        if (topics[t].name[0] != '\0')
+            printf("  topic '%s': servidos=%lu en_cola=%d rondas_sin_tokens=%lu\n",
+                   topics[t].name, topics[t].servidos, topics[t].cola_n, topics[t].rondas_sin_tokens);
+    }
+}
+
+// Busca la siguiente unidad completa al inicio del buffer de la conexión: un frame
+// "<cabecera>\n<datos>" si el publisher usa lz4, si no una línea terminada en '\n'
+// (cada línea es un mensaje y consume un token) o, para un cliente sin delimitador,
+// lo que devolvió el último read().
+// Devuelve el largo total de la unidad, 0 si todavía falta que llegue algo o -1 si es inválida.
+int unidad_completa(const struct Conexion *c, int con_frames) {
+    if (con_frames) {
+        size_t max = (c->len < MAX_CABECERA) ? c->len : MAX_CABECERA;
+        const char *nl = memchr(c->entrada, '\n', max);
+        if (nl == NULL)
+            return (c->len >= MAX_CABECERA) ? -1 : 0;
+
+        char cabecera[MAX_CABECERA];
+        size_t h = nl - c->entrada;
+        memcpy(cabecera, c->entrada, h);
+        cabecera[h] = '\0';
+        const char *ultimo = strrchr(cabecera, ' ');
+        if (ultimo == NULL)
+            return -1;
+        size_t len = strtoul(ultimo + 1, NULL, 10);
+        if (len >= BUFFER_SIZE)
+            return -1;
+        return (c->len >= h + 1 + len) ? (int)(h + 1 + len) : 0;
+    }
+    if (c->modo == ENTRADA_LECTURAS)
+        return (c->len < BUFFER_SIZE) ? (int)c->len : -1;
+
+    size_t max = (c->len < BUFFER_SIZE) ? c->len : BUFFER_SIZE;
+    const char *nl = memchr(c->entrada, '\n', max);
+    if (nl != NULL)
+        return (int)(nl - c->entrada + 1);
+    return (c->len >= BUFFER_SIZE) ? -1 : 0;
+}
+
+void consumir(struct Conexion *c, size_t n) {
+    memmove(c->entrada, c->entrada + n, c->len - n);
+    c->len -= n;
+}
+
+// Busca el topic por nombre o lo crea en la primera posición libre; -1 si no hay lugar
+int buscar_topic(struct Topic *topics, const char *name) {
+    for (int t = 0; t < MAX_TOPICS; t++) {
+        if (strcmp(topics[t].name, name) == 0 || topics[t].name[0] == '\0') {
+            strcpy(topics[t].name, name);
+            return t;
+        }
+    }
+    return -1;
+}
+
+// REGISTRO DE UN PUBLISHER
+// Formato: "PUB:<topic> [@lz4]"; con @lz4 los mensajes siguientes llegan como frames
+void registrar_publisher(struct Publisher *p, int sd, const char *linea, struct Topic *topics) {
+    char topic[50], opcion[16] = "";
+    if (sscanf(linea, "PUB:%49s %15s", topic, opcion) < 1) {
+        fprintf(stderr, "PUB inválido: %s\n", linea);
+        return;
+    }
+    memset(p, 0, sizeof(*p)); // Estadísticas y cubeta nuevas
+    strcpy(p->topic, topic);
+    p->socket = sd;
+    p->codec = (strcmp(opcion, "@lz4") == 0) ? CODEC_LZ4 : CODEC_NINGUNO;
+    // Los mensajes del publisher esperan en la cola de su topic
+    p->t = buscar_topic(topics, topic);
+    printf("Publisher registrado en topic: %s %s\n", topic, opcion);
+}
+
+// REGISTRO DE UN SUBSCRIBER
+// Formato: "SUB:<topic> [filtro] [@lz4|@zstd]"; el filtro se compila una sola vez aquí
+void registrar_subscriber(int i, int sd, const char *linea, struct Topic *topics) {
+    char topic[50], opts[2][MAX_FILTRO_LEN], expr[MAX_FILTRO_LEN] = "";
+    int campos = sscanf(linea, "SUB:%49s %255s %255s", topic, opts[0], opts[1]);
+    int filtro = 0, codec = CODEC_NINGUNO, ok = (campos >= 1);
+    for (int k = 0; k + 1 < campos && ok; k++) {
+        if (strcmp(opts[k], "@lz4") == 0)
+            codec = CODEC_LZ4;
+        else if (strcmp(opts[k], "@zstd") == 0)
+            codec = CODEC_ZSTD;
+        else if (opts[k][0] == '@' || filtro != 0 || (filtro = obtener_filtro(opts[k])) < 0)
+            ok = 0;
+        else
+            strcpy(expr, opts[k]);
+    }
+    if (!ok) {
+        liberar_filtro(filtro);
+        fprintf(stderr, "SUB inválido: %s\n", linea);
+        return;
+    }
+    int t = buscar_topic(topics, topic);
+    if (t < 0) {
+        liberar_filtro(filtro); // Sin topic disponible, el filtro no se usa
+        return;
+    }
+    topics[t].subscribers[i] = sd;
+    liberar_filtro(topics[t].filtros[i]);
+    topics[t].filtros[i] = filtro;
+    topics[t].codecs[i] = codec;
+    // Un suscriptor zstd necesita el diccionario vigente antes del primer frame
+    if (codec == CODEC_ZSTD && topics[t].cdict != NULL)
+        enviar_diccionario(sd, &topics[t]);
+    printf("Subscriber suscrito a topic: %s filtro: %s\n", topic, expr);
+}
+
+// Procesa las unidades completas del buffer de la conexión i. Los mensajes de un publisher
+// pasan a la cola de su topic si tienen turno (deficit round robin por bytes), tokens y
+// lugar en la cola; si no, se quedan en el buffer para la ronda siguiente.
+// Devuelve 1 si quedaron mensajes completos esperando, 0 si no, o -1 si llegó algo inválido.
+int procesar_entrada(struct Conexion *c, struct Publisher *p, int i, int sd,
+                     struct Topic *topics, double ahora) {
+    int turno = 0; // El quantum de esta ronda ya se sumó
+    while (c->len > 0) {
+        int es_publisher = (p->socket == sd);
+        int con_frames = es_publisher && p->codec == CODEC_LZ4;
+        int n = unidad_completa(c, con_frames);
+        if (n <= 0) {
+            p->deficit = 0; // Sin mensajes completos no se acumula crédito, como en servir_colas()
+            return n;
+        }
+
+        char texto[BUFFER_SIZE];
+        const char *bloque_lz4 = NULL; // Bloque lz4 del publisher, se reenvía sin recomprimir
+        size_t bloque_len = 0;
+        int len;
+
+        if (con_frames) {
+            // Un frame se descomprime una sola vez (para los filtros y los suscriptores sin lz4)
+            const char *nl = memchr(c->entrada, '\n', n);
+            const char *datos = nl + 1;
+            size_t datos_len = n - (datos - c->entrada);
+            // sscanf() necesita el terminador, que el buffer de entrada no tiene:
+            // se copia la cabecera (unidad_completa() ya comprobó que entra en MAX_CABECERA)
+            char cabecera[MAX_CABECERA];
+            memcpy(cabecera, c->entrada, nl - c->entrada);
+            cabecera[nl - c->entrada] = '\0';
+            size_t rawlen, clen;
+            if (sscanf(cabecera, "LZ4 %zu %zu", &rawlen, &clen) == 2 && clen == datos_len &&
+                rawlen < BUFFER_SIZE) {
+                len = LZ4_decompress_safe(datos, texto, (int)clen, BUFFER_SIZE - 1);
+                if (len != (int)rawlen)
+                    return -1;
+                bloque_lz4 = datos;
+                bloque_len = clen;
+            } else if (sscanf(cabecera, "RAW %zu", &rawlen) == 1 && rawlen == datos_len) {
+                memcpy(texto, datos, datos_len);
+                len = (int)datos_len;
+            } else {
+                return -1;
+            }
+            texto[len] = '\0';
+        } else {
+            // Texto: se quita el fin de línea
+            len = n;
+            while (len > 0 && (c->entrada[len - 1] == '\n' || c->entrada[len - 1] == '\r'))
+                len--;
+            memcpy(texto, c->entrada, len);
+            texto[len] = '\0';
+
+            // Líneas de registro; el texto de una conexión que no es publisher se ignora
+            if (strncmp(texto, "PUB:", 4) == 0 || strncmp(texto, "SUB:", 4) == 0 || !es_publisher) {
+                if (strncmp(texto, "PUB:", 4) == 0)
+                    registrar_publisher(p, sd, texto, topics);
+                else if (strncmp(texto, "SUB:", 4) == 0)
+                    registrar_subscriber(i, sd, texto, topics);
+                consumir(c, n);
+                continue;
+            }
+        }
+
+        // Un mensaje vacío (línea o frame de largo 0) no se reenvía
+        if (len == 0) {
+            consumir(c, n);
+            continue;
+        }
+
+        // MENSAJE DE UN PUBLISHER
+        // No se reenvía en el momento: espera turno en la cola de su topic
+        if (!turno) {
+            p->deficit += QUANTUM_CONEXION;
+            turno = 1;
+        }
+        if (p->deficit < len)
+            return 1; // La deuda de bytes de mensajes grandes se paga esperando rondas
+        if (p->t >= 0 && topics[p->t].cola_n == COLA_LEN)
+            return 1;
+        recargar(&p->cubeta, tasa_publisher, ahora);
+        if (p->cubeta.tokens < 1) {
+            // Se cuenta una vez por mensaje frenado, no una vez por ronda
+            if (ahora >= p->frenado_hasta) {
+                p->limitados++;
+                hubo_actividad = 1;
+            }
+            p->frenado_hasta = ahora + (1 - p->cubeta.tokens) / tasa_publisher;
+            return 1;
+        }
+
+        hubo_actividad = 1;
+        if (p->t < 0) {
+            // Sin topic no hay cola: se descarta sin gastar tokens, igual que en el broker UDP
+            p->descartados++;
+            consumir(c, n);
+            continue;
+        }
+
+        p->cubeta.tokens -= 1;
+        p->deficit -= len;
+        p->admitidos++;
+        p->bytes += len;
+
+        struct Topic *t = &topics[p->t];
+        struct Mensaje *m = &t->cola[(t->cola_ini + t->cola_n) % COLA_LEN];
+        t->cola_n++;
+        m->origen = sd;
+        m->len = len;
+        memcpy(m->texto, texto, len + 1);
+        m->lz4_len = bloque_len;
+        if (bloque_lz4 != NULL)
+            memcpy(m->lz4, bloque_lz4, bloque_len);
+        consumir(c, n);
+    }
+    p->deficit = 0;
+    return 0;
+}
+
+// Cierra la conexión i y libera sus suscripciones, filtros y registro de publisher
+void cerrar_cliente(int i, int *client_sockets, struct Conexion *conexiones,
+                    struct Topic *topics, struct Publisher *publishers) {
+    int sd = client_sockets[i];
+    for (int t = 0; t < MAX_TOPICS; t++) {
+        if (topics[t].subscribers[i] == sd) {
+            topics[t].subscribers[i] = 0;
+            liberar_filtro(topics[t].filtros[i]);
+            topics[t].filtros[i] = 0;
+            topics[t].codecs[i] = CODEC_NINGUNO;
+        }
+        // Los mensajes que siguen en cola ya no tienen a quién excluir del reenvío
+        for (int q = 0; q < topics[t].cola_n; q++) {
+            struct Mensaje *m = &topics[t].cola[(topics[t].cola_ini + q) % COLA_LEN];
+            if (m->origen == sd)
+                m->origen = -1;
+        }
+    }
+    if (publishers[i].socket == sd) {
+        publishers[i].socket = 0;
+        publishers[i].codec = CODEC_NINGUNO;
+    }
+    memset(&conexiones[i], 0, sizeof(conexiones[i]));
+    close(sd);
+    client_sockets[i] = 0;
+}
+
+int main(int argc, char *argv[]) {
     int server_fd, new_socket, client_sockets[MAX_CLIENTS];
     struct sockaddr_in address; // Estructura que almacena la dirección del servidor
     int max_sd, activity, valread;
     fd_set readfds;             // Conjunto de descriptores de archivo monitoreados por select()
-    char buffer[BUFFER_SIZE];
     int addrlen = sizeof(address);
 
-    struct Topic topics[MAX_TOPICS] = {0};
+    static struct Topic topics[MAX_TOPICS]; // static: con el diccionario es grande para la pila
+    static struct Conexion conexiones[MAX_CLIENTS];
     struct Publisher publishers[MAX_CLIENTS] = {0};
 
+    // Límites opcionales: mensajes por segundo por publisher y por topic
+    if (argc >= 2)
+        tasa_publisher = atof(argv[1]);
+    if (argc >= 3)
+        tasa_topic = atof(argv[2]);
+    if (tasa_publisher <= 0 || tasa_topic <= 0) {
+        fprintf(stderr, "Uso: %s [msgs/s por publisher] [msgs/s por topic]\n", argv[0]);
+        return 1;
+    }
+
     // Inicializa la lista de clientes
     for (int i = 0; i < MAX_CLIENTS; i++)
         client_sockets[i] = 0;
@@ -65,25 +821,41 @@ int main() {
 
     printf("Broker TCP en ejecución. Escuchando en el puerto %d...\n", PORT);
 
+    int inicio = 0;                // Conexión por la que empieza la siguiente ronda de lectura
+    double proximas_estadisticas = ahora_seg() + ESTADISTICAS_SEG;
+
     // Bucle principal del servidor
     while (1) {
         // Limpia y configura el conjunto de descriptores
         FD_ZERO(&readfds);
         FD_SET(server_fd, &readfds);  // Agrega el socket del servidor al conjunto
         max_sd = server_fd;
+        double ahora = ahora_seg();
+        int pendientes = 0;           // Hay colas o mensajes esperando: no se bloquea en select()
 
         // Agrega los sockets activos de clientes al conjunto
         for (int i = 0; i < MAX_CLIENTS; i++) {
             int sd = client_sockets[i];
+            pendientes |= conexiones[i].bloqueado;
+            // Con el buffer de recepción lleno (o el cliente ya cerrado) el socket no se lee por ahora.
+            // Un cliente sin delimitador no se lee hasta procesar su lectura anterior
+            if (sd > 0 && (conexiones[i].eof || conexiones[i].len == ENTRADA_SIZE ||
+                           (conexiones[i].modo == ENTRADA_LECTURAS && conexiones[i].len > 0)))
+                continue;
             if (sd > 0)
                 FD_SET(sd, &readfds);
             if (sd > max_sd)
                 max_sd = sd;
         }
+        for (int t = 0; t < MAX_TOPICS; t++)
+            pendientes |= (topics[t].cola_n > 0);
 
         // SELECT: MONITOREA LOS SOCKETS
-        // select(): bloquea hasta que uno o más sockets estén listos para lectura
-        activity = select(max_sd + 1, &readfds, NULL, NULL, NULL);
+        // select(): bloquea hasta que uno o más sockets estén listos para lectura.
+        // Con trabajo pendiente solo espera lo justo para que se recarguen las cubetas;
+        // si no, el timeout sirve para imprimir las estadísticas periódicas.
+        struct timeval tv = {pendientes ? 0 : 1, pendientes ? ESPERA_COLAS_US : 0};
+        activity = select(max_sd + 1, &readfds, NULL, NULL, &tv);
         if ((activity < 0) && (errno != EINTR))
             perror("Error en select()");
 
@@ -103,74 +875,48 @@ int main() {
         }
 
         // PROCESAR DATOS EN SOCKETS EXISTENTES
-        for (int i = 0; i < MAX_CLIENTS; i++) {
+        // Se empieza cada vez por una conexión distinta para no favorecer a los índices bajos
+        for (int k = 0; k < MAX_CLIENTS; k++) {
+            int i = (inicio + k) % MAX_CLIENTS;
             int sd = client_sockets[i];
+            struct Conexion *c = &conexiones[i];
+            if (sd == 0)
+                continue;
+
             if (FD_ISSET(sd, &readfds)) {
-                // read(): lee datos del socket TCP
-                valread = read(sd, buffer, BUFFER_SIZE - 1);
-                if (valread <= 0) {
-                    // Si la conexión se cerró o hubo error
-                    close(sd);
-                    client_sockets[i] = 0;
-                } else {
-                    buffer[valread] = '\0'; // Añade terminador de cadena
-
-                    // REGISTRO DE UN PUBLISHER
-                    if (strncmp(buffer, "PUB:", 4) == 0) {
-                        char topic[50];
-                        sscanf(buffer, "PUB:%s", topic);
-                        strcpy(publishers[i].topic, topic);
-                        publishers[i].socket = sd;
-                        printf("Publisher registrado en topic: %s\n", topic);
-                    }
-
-                    // REGISTRO DE UN SUBSCRIBER
-                    else if (strncmp(buffer, "SUB:", 4) == 0) {
-                        char topic[50];
-                        sscanf(buffer, "SUB:%s", topic);
-                        for (int t = 0; t < MAX_TOPICS; t++) {
-                            // Si el topic existe o está vacío, se asigna
-                            if (strcmp(topics[t].name, topic) == 0 || topics[t].name[0] == '\0') {
-                                strcpy(topics[t].name, topic);
-                                topics[t].subscribers[i] = sd;
-                                break;
-                            }
-                        }
-                        printf("Subscriber suscrito a topic: %s\n", topic);
-                    }
-
-                    // MENSAJE DE UN PUBLISHER
-                    else {
-                        char topic_pub[50] = "";
-                        for (int p = 0; p < MAX_CLIENTS; p++) {
-                            if (publishers[p].socket == sd) {
-                                strcpy(topic_pub, publishers[p].topic);
-                                break;
-                            }
-                        }
-
-                        // Si no hay topic asociado, no se reenvía
-                        if (strlen(topic_pub) == 0)
-                            continue;
-
-                        // Reenvía el mensaje a todos los suscriptores del mismo topic
-                        for (int t = 0; t < MAX_TOPICS; t++) {
-                            if (strcmp(topics[t].name, topic_pub) == 0) {
-                                for (int s = 0; s < MAX_CLIENTS; s++) {
-                                    int dest = topics[t].subscribers[s];
-                                    if (dest != 0 && dest != sd) {
-                                        // send(): envía los datos al socket destino
-                                        send(dest, buffer, strlen(buffer), 0);
-                                    }
-                                }
-                                break;
-                            }
-                        }
-
-                        printf("[%s] %s\n", topic_pub, buffer);
-                    }
+                // read(): agrega al buffer lo que haya llegado, sin esperar a que se complete nada
+                size_t max = (c->modo == ENTRADA_LECTURAS) ? BUFFER_SIZE - 1 : ENTRADA_SIZE - c->len;
+                valread = read(sd, c->entrada + c->len, max);
+                if (valread < 0) {
+                    cerrar_cliente(i, client_sockets, conexiones, topics, publishers);
+                    continue;
                 }
+                if (valread == 0)
+                    c->eof = 1;
+                c->len += valread;
+                if (c->modo == ENTRADA_NUEVA && c->len > 0)
+                    c->modo = memchr(c->entrada, '\n', c->len) ? ENTRADA_LINEAS : ENTRADA_LECTURAS;
             }
+
+            int r = procesar_entrada(c, &publishers[i], i, sd, topics, ahora);
+            if (r < 0)
+                fprintf(stderr, "Datos inválidos del cliente, se cierra la conexión\n");
+            c->bloqueado = (r == 1);
+            // Si la conexión se cerró o hubo error se liberan sus suscripciones y filtros
+            // (los mensajes completos que esperaban turno se reenvían antes de cerrar)
+            if (r < 0 || (c->eof && r == 0))
+                cerrar_cliente(i, client_sockets, conexiones, topics, publishers);
+        }
+        inicio = (inicio + 1) % MAX_CLIENTS;
+
+        // REENVÍO: una ronda de deficit round robin sobre las colas de los topics
+        servir_colas(topics);
+
+        if (ahora_seg() >= proximas_estadisticas) {
+            if (hubo_actividad)
+                imprimir_estadisticas(topics, publishers);
+            hubo_actividad = 0;
+            proximas_estadisticas = ahora_seg() + ESTADISTICAS_SEG;
         }
     }
 }
@@ -1,8 +1,11 @@
+// Compilar: gcc publisher_tcp.c -o publisher_tcp -llz4
+
 #include <stdio.h>          // Librería estándar de entrada y salida
 #include <stdlib.h>         // Librería general (malloc, exit, etc.)
 #include <string.h>         // Manejo de cadenas (strlen, strcpy, strcmp, etc.)
 #include <unistd.h>         // Funciones POSIX (close, read, write)
 #include <arpa/inet.h>      // Librería para manejo de direcciones IP y funciones de red
+#include <lz4.h>            // Compresión opcional de los mensajes
 
 #define PORT 5050
 #define BUFFER_SIZE 1024
@@ -10,7 +13,8 @@
 int main() {
     int sock = 0;
     struct sockaddr_in serv_addr; // Estructura para almacenar la dirección del servidor
-    char mensaje[BUFFER_SIZE], topic[50], header[60];
+    char mensaje[BUFFER_SIZE], topic[50], header[60], opcion[8];
+    char comp[BUFFER_SIZE], frame[BUFFER_SIZE + 64]; // Mensaje comprimido y frame a enviar
 
     // CREACIÓN DEL SOCKET DEL CLIENTE (PUBLISHER)
     // socket(): crea un endpoint de comunicación
@@ -50,7 +54,15 @@ int main() {
     printf("Ingresa el topic al que publicarás (ej: futbol): ");
     fgets(topic, 50, stdin);
     topic[strcspn(topic, "\n")] = 0;              // Elimina salto de línea del final
-    sprintf(header, "PUB:%s", topic);             // Construye el encabezado de registro
+
+    // COMPRESIÓN (OPCIONAL)
+    // Con "@lz4" el broker espera frames "LZ4 <rawlen> <len>\n<datos>" (o "RAW <len>\n<datos>")
+    // y reenvía el bloque comprimido a los suscriptores lz4 sin volver a comprimirlo
+    printf("¿Comprimir los mensajes con lz4? (s/N): ");
+    fgets(opcion, sizeof(opcion), stdin);
+    int usar_lz4 = (opcion[0] == 's' || opcion[0] == 'S');
+    // La línea de registro termina en '\n' para que el broker la separe del primer mensaje
+    sprintf(header, usar_lz4 ? "PUB:%s @lz4\n" : "PUB:%s\n", topic); // Construye el encabezado de registro
     send(sock, header, strlen(header), 0);        // Envía el encabezado al broker
     printf("Registrado como publisher del topic '%s'\n", topic);
 
@@ -59,16 +71,33 @@ int main() {
     // mediante send(), que escribe datos en el flujo TCP.
     while (1) {
         printf("> ");
-        fgets(mensaje, BUFFER_SIZE, stdin);
+        if (fgets(mensaje, BUFFER_SIZE, stdin) == NULL)
+            break;                           // Fin de la entrada
         mensaje[strcspn(mensaje, "\n")] = 0; // Elimina salto de línea
 
         // Si el usuario escribe "exit", se rompe el bucle y se cierra la conexión
         if (strcmp(mensaje, "exit") == 0)
             break;
+        // Una línea vacía no se publica
+        if (mensaje[0] == '\0')
+            continue;
 
         // send(): envía los datos al servidor
         // TCP garantiza que los bytes lleguen completos y en el mismo orden
-        send(sock, mensaje, strlen(mensaje), 0);
+        if (usar_lz4) {
+            // Se comprime solo si ocupa menos; la cabecera delimita el mensaje dentro del flujo
+            int len = strlen(mensaje);
+            int clen = LZ4_compress_default(mensaje, comp, len, len - 1);
+            int h = (clen > 0) ? sprintf(frame, "LZ4 %d %d\n", len, clen) : sprintf(frame, "RAW %d\n", len);
+            memcpy(frame + h, (clen > 0) ? comp : mensaje, (clen > 0) ? clen : len);
+            send(sock, frame, h + ((clen > 0) ? clen : len), 0);
+        } else {
+            // Sin compresión cada mensaje es una línea: el '\n' lo separa del siguiente
+            int len = strlen(mensaje);
+            mensaje[len] = '\n';
+            send(sock, mensaje, len + 1, 0);
+            mensaje[len] = '\0';
+        }
         printf("Mensaje enviado: %s\n", mensaje);
     }
 
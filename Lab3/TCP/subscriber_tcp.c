@@ -1,16 +1,95 @@
+// Compilar: gcc subscriber_tcp.c -o subscriber_tcp -llz4 -lzstd
+
 #include <stdio.h>          // Librería estándar de entrada y salida
 #include <stdlib.h>         // Librería general (malloc, exit, etc.)
 #include <string.h>         // Manejo de cadenas (strlen, strcpy, strcmp, etc.)
 #include <unistd.h>         // Funciones POSIX (close, read, write)
 #include <arpa/inet.h>      // Librería para manejo de direcciones IP y funciones de red
+#include <lz4.h>            // Descompresión de los frames lz4
+#include <zstd.h>           // Descompresión de los frames zstd (con diccionario del topic)
 
 #define PORT 5050
 #define BUFFER_SIZE 1024
+#define FRAME_SIZE (BUFFER_SIZE + 64)
+#define DICT_CAP 1024
+
+// Diccionario zstd vigente del topic (lo envía el broker en un frame DIC).
+// Se carga una sola vez en un ZSTD_DDict y se reutiliza para todos los frames
+ZSTD_DDict *ddict = NULL;
+unsigned dict_id = 0;
+
+// Lee un frame completo "<cabecera>\n<datos>"; el último número de la cabecera es el largo de los datos.
+// Devuelve el largo del frame, 0 si el broker cerró la conexión o -1 si es inválido
+int leer_frame(int sd, char *frame, size_t cap) {
+    size_t h = 0;
+    while (h < 64 && h < cap) {
+        int r = recv(sd, frame + h, 1, 0);
+        if (r <= 0)
+            return r;
+        if (frame[h++] == '\n')
+            break;
+    }
+    if (h == 0 || frame[h - 1] != '\n')
+        return -1;
+
+    frame[h - 1] = '\0';
+    const char *ultimo = strrchr(frame, ' ');
+    size_t len = (ultimo != NULL) ? strtoul(ultimo + 1, NULL, 10) : cap;
+    frame[h - 1] = '\n';
+    if (h + len > cap)
+        return -1;
+
+    // MSG_WAITALL: espera hasta tener todos los datos del frame
+    if (len > 0 && recv(sd, frame + h, len, MSG_WAITALL) != (ssize_t)len)
+        return 0;
+    return (int)(h + len);
+}
+
+// Decodifica un frame y deja el mensaje en out.
+// Devuelve el largo del mensaje, 0 si era un diccionario o -1 si el frame no se puede decodificar
+int decodificar_frame(const char *frame, size_t len, char *out, size_t out_cap) {
+    static ZSTD_DCtx *dctx = NULL;
+    const char *datos = memchr(frame, '\n', len) + 1;
+    size_t datos_len = len - (datos - frame);
+    size_t rawlen, n;
+    unsigned id;
+
+    if (sscanf(frame, "RAW %zu", &n) == 1 && n == datos_len && n < out_cap) {
+        memcpy(out, datos, n);
+        return (int)n;
+    }
+    if (sscanf(frame, "LZ4 %zu %zu", &rawlen, &n) == 2 && n == datos_len && rawlen < out_cap) {
+        int r = LZ4_decompress_safe(datos, out, (int)n, (int)out_cap - 1);
+        return (r == (int)rawlen) ? r : -1;
+    }
+    if (sscanf(frame, "ZST %u %zu %zu", &id, &rawlen, &n) == 3 && n == datos_len && rawlen < out_cap) {
+        // TCP entrega el DIC antes que los frames que lo usan, así que el id siempre debería coincidir
+        if (id != 0 && id != dict_id)
+            return -1;
+        if (dctx == NULL)
+            dctx = ZSTD_createDCtx();
+        size_t r = (id != 0)
+            ? ZSTD_decompress_usingDDict(dctx, out, out_cap - 1, datos, n, ddict)
+            : ZSTD_decompressDCtx(dctx, out, out_cap - 1, datos, n);
+        return (!ZSTD_isError(r) && r == rawlen) ? (int)r : -1;
+    }
+    if (sscanf(frame, "DIC %u %zu", &id, &n) == 2 && n == datos_len && n <= DICT_CAP) {
+        ZSTD_freeDDict(ddict);
+        ddict = ZSTD_createDDict(datos, n);
+        dict_id = (ddict != NULL) ? id : 0;
+        if (ddict == NULL)
+            return -1;
+        printf("Recibido diccionario zstd %u (%zu bytes)\n", id, n);
+        return 0;
+    }
+    return -1;
+}
 
 int main() {
     int sock = 0;
     struct sockaddr_in serv_addr; // Estructura para almacenar la dirección del servidor (broker)
-    char buffer[BUFFER_SIZE], topic[50], header[60];
+    char buffer[BUFFER_SIZE], topic[50], filtro[256], codec[8], header[340];
+    char frame[FRAME_SIZE]; // Frame recibido cuando se negocia compresión
 
     // CREACIÓN DEL SOCKET DEL CLIENTE (SUBSCRIBER)
     // socket(): crea un endpoint de comunicación
@@ -46,9 +125,27 @@ int main() {
     fgets(topic, 50, stdin);
     topic[strcspn(topic, "\n")] = 0; // Elimina salto de línea
 
+    // FILTRO DE CONTENIDO (OPCIONAL)
+    // El broker solo reenviará los mensajes cuyos campos clave=valor cumplan todas las condiciones
+    printf("Filtro opcional (ej: ciudad=lima,temp=10..30,equipo^=real; Enter para recibir todo): ");
+    fgets(filtro, sizeof(filtro), stdin);
+    filtro[strcspn(filtro, " \r\n")] = 0; // El filtro no admite espacios
+
+    // COMPRESIÓN (OPCIONAL)
+    // Con lz4 o zstd el broker envía frames comprimidos en vez del texto plano
+    printf("Compresión (lz4, zstd; Enter para ninguna): ");
+    fgets(codec, sizeof(codec), stdin);
+    codec[strcspn(codec, " \r\n")] = 0;
+    if (codec[0] != '\0' && strcmp(codec, "lz4") != 0 && strcmp(codec, "zstd") != 0) {
+        printf("Compresión desconocida '%s', se recibirá sin comprimir\n", codec);
+        codec[0] = '\0';
+    }
+
     // IDENTIFICACIÓN DEL SUBSCRIPTOR
-    // Se construye un encabezado "SUB:<topic>" que el broker interpreta para registrar la suscripción
-    sprintf(header, "SUB:%s", topic);
+    // Se construye un encabezado "SUB:<topic> [filtro] [@lz4|@zstd]" que el broker interpreta para registrar la suscripción
+    sprintf(header, "SUB:%s%s%s%s%s\n", topic,
+            filtro[0] ? " " : "", filtro,
+            codec[0] ? " @" : "", codec);
     send(sock, header, strlen(header), 0); // Envía el mensaje de suscripción al broker
     printf("Suscrito al topic '%s'\n", topic);
     printf("Esperando mensajes del broker...\n\n");
@@ -59,7 +156,24 @@ int main() {
     while (1) {
         // read(): lee los datos del socket TCP
         // TCP garantiza que los datos lleguen completos y en el orden correcto
-        int valread = read(sock, buffer, BUFFER_SIZE - 1);
+        int valread;
+        if (codec[0] != '\0') {
+            // Con compresión cada mensaje llega como un frame delimitado por su cabecera
+            // Se deja lugar para el terminador: decodificar_frame() usa sscanf() sobre la cabecera
+            int n = leer_frame(sock, frame, sizeof(frame) - 1);
+            if (n > 0)
+                frame[n] = '\0';
+            valread = (n > 0) ? decodificar_frame(frame, n, buffer, BUFFER_SIZE) : n;
+            if (n > 0 && valread == 0)
+                continue; // Era un diccionario
+            if (n > 0 && valread < 0) {
+                // La cabecera ya delimitó el frame, así que el flujo sigue sincronizado
+                fprintf(stderr, "Frame inválido recibido del broker\n");
+                continue;
+            }
+        } else {
+            valread = read(sock, buffer, BUFFER_SIZE - 1);
+        }
 
         if (valread > 0) {
             buffer[valread] = '\0'; // Agrega terminador de cadena
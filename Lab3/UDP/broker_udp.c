@@ -1,30 +1,296 @@
 
-// gcc broker_udp.c -o broker_udp
+// gcc broker_udp.c -o broker_udp -llz4 -lzstd
 //  ./broker_udp            # escucha en 0.0.0.0:5000
+//  ./broker_udp 20 100     # limita a 20 msgs/s por publisher y 100 msgs/s por topic
 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <lz4.h>
+#include <zstd.h>
+#include <zdict.h>
 
 #define BROKER_PORT 5000
 #define BUF_SIZE 2048
 #define MAX_SUBSCRIBERS 256
 #define MAX_TOPIC_LEN 128
+#define MAX_FILTROS 64          // filtros distintos compilados (el slot 0 significa "sin filtro")
+#define MAX_FILTRO_LEN 256
+#define MAX_CONDICIONES 8
+#define MAX_CLAVE 32
+#define MAX_VALOR 64
+#define MAX_CAMPOS 32
+#define MAX_TOPICS 64           // topics con estado de compresion (diccionario zstd)
+#define FRAME_SIZE (BUF_SIZE + 64) // payload + cabecera de frame
+#define MUESTRAS_DICT 64        // mensajes de muestra para entrenar el diccionario de un topic
+#define MUESTRAS_SIZE 16384
+#define DICT_CAP 1024           // el diccionario tiene que caber en un datagrama
+#define ZSTD_NIVEL 3
+#define MAX_PUBLISHERS 256
+#define TASA_PUBLISHER 50.0     // msgs/s por publisher (se puede cambiar por argumento)
+#define TASA_TOPIC 200.0        // msgs/s por topic (se puede cambiar por argumento)
+#define RAFAGA_SEG 1.0          // una cubeta llena acumula RAFAGA_SEG segundos de mensajes
+#define COLA_LEN 64             // publicaciones pendientes por topic (absorbe rafagas de varios lotes)
+#define QUANTUM 1500            // bytes que gana cada topic por ronda del DRR
+#define LOTE_RECV 32            // datagramas leidos por vuelta antes de atender las colas
+#define ESPERA_COLAS_US 1000    // con colas pendientes, select espera solo esto
+#define ESTADISTICAS_SEG 10
+#define INACTIVO_SEG 60.0       // con la tabla llena se reemplaza un publisher/topic inactivo hace esto
+
+// cubeta de tokens: se recarga a "tasa" tokens/s y cada mensaje consume uno
+typedef struct {
+    double tokens;
+    double ultimo;             // instante de la ultima recarga, 0 = cubeta nueva (llena)
+} cubeta_t;
+
+// publisher identificado por su direccion, con su limite y sus estadisticas
+typedef struct {
+    struct sockaddr_in addr;
+    cubeta_t cubeta;
+    unsigned long admitidos, limitados;
+    unsigned long descartados;  // sin lugar en la cola del topic o en la tabla de topics
+    int used;
+} publisher_t;
+
+publisher_t publishers[MAX_PUBLISHERS];
+double tasa_publisher = TASA_PUBLISHER;
+double tasa_topic = TASA_TOPIC;
+int drr_inicio = 0;            // topic por el que empieza la siguiente ronda
+int hubo_actividad = 0;        // para no imprimir estadisticas repetidas
+unsigned long sin_publisher = 0; // publicaciones descartadas con la tabla de publishers llena
+
+// compresion negociada por el subscriber en el SUB ("@lz4" o "@zstd")
+enum { CODEC_NINGUNO, CODEC_LZ4, CODEC_ZSTD };
 
 typedef struct {
     struct sockaddr_in addr;   // direccin del subscriber
     char topic[MAX_TOPIC_LEN]; // topic al que est suscrito
+    int filtro;                // indice en filtros[], 0 = recibe todo el topic
+    int codec;                 // CODEC_*, los subscribers con compresion reciben frames
     int used;
 } subscriber_t;
 
 subscriber_t subscribers[MAX_SUBSCRIBERS];
 
+// estado de compresion de un topic: muestras y diccionario zstd entrenado
+typedef struct {
+    char name[MAX_TOPIC_LEN];
+    char muestras[MUESTRAS_SIZE];
+    size_t muestra_len[MUESTRAS_DICT];
+    int n_muestras;
+    size_t muestras_usado;
+    char dict[DICT_CAP];
+    size_t dict_len;
+    unsigned dict_id;          // 0 = todavia no hay diccionario
+    ZSTD_CDict* cdict;
+
+    // planificacion: cola de datagramas PUB/PUBZ pendientes servida por DRR
+    char cola[COLA_LEN][BUF_SIZE];
+    size_t cola_len[COLA_LEN];
+    int cola_ini, cola_n;
+    long deficit;
+    cubeta_t cubeta;           // limite de msgs/s del topic
+    unsigned long servidos, descartados, rondas_sin_tokens;
+    int used;
+} topic_t;
+
+topic_t topics[MAX_TOPICS];
+unsigned ultimo_dict_id = 0;
+ZSTD_CCtx* zstd_cctx = NULL;
+
+/* Filtros de contenido
+ * Un SUB puede llevar una expresion "cond1,cond2,..." (todas deben cumplirse)
+ * que se evalua sobre los campos clave=valor del payload:
+ *   clave=valor     igualdad exacta
+ *   clave^=prefijo  el valor empieza por prefijo
+ *   clave=min..max  rango numerico inclusivo (min o max pueden omitirse)
+ * Cada expresion distinta se compila una sola vez y la comparten todos los
+ * subscribers que la usan. */
+enum { COND_IGUAL, COND_PREFIJO, COND_RANGO };
+
+typedef struct {
+    char clave[MAX_CLAVE];
+    size_t clave_len;
+    int op;
+    char valor[MAX_VALOR];
+    size_t valor_len;
+    double min, max;
+} condicion_t;
+
+typedef struct {
+    char expr[MAX_FILTRO_LEN];     // expresion original, sirve para compartir el filtro
+    condicion_t conds[MAX_CONDICIONES];
+    int n;
+    int refs;                      // subscribers que lo usan; 0 = slot libre
+} filtro_t;
+
+filtro_t filtros[MAX_FILTROS];
+
+// campo clave=valor extraido del payload (apunta dentro del payload, no se copia)
+typedef struct {
+    const char* clave;
+    size_t clave_len;
+    const char* valor;
+    size_t valor_len;
+    double num;
+    int es_num;
+} campo_t;
+
+// Compila una condicion (s, len) sin terminador; devuelve -1 si es invalida
+int compilar_condicion(const char* s, size_t len, condicion_t* c) {
+    const char* eq = memchr(s, '=', len);
+    if (eq == NULL || eq == s) return -1;
+
+    size_t klen = eq - s;
+    c->op = COND_IGUAL;
+    if (s[klen - 1] == '^') {
+        c->op = COND_PREFIJO;
+        if (--klen == 0) return -1;
+    }
+    size_t vlen = len - (eq + 1 - s);
+    if (klen >= MAX_CLAVE || vlen >= MAX_VALOR) return -1;
+
+    memcpy(c->clave, s, klen);
+    c->clave[klen] = '\0';
+    c->clave_len = klen;
+    memcpy(c->valor, eq + 1, vlen);
+    c->valor[vlen] = '\0';
+    c->valor_len = vlen;
+
+    char* dots = strstr(c->valor, "..");
+    if (c->op == COND_IGUAL && dots != NULL) {
+        char* end;
+        c->min = -HUGE_VAL;
+        c->max = HUGE_VAL;
+        *dots = '\0';    // strtod("10..30") leeria "10." y se comeria un punto
+        if (dots != c->valor) {
+            c->min = strtod(c->valor, &end);
+            if (*end != '\0') return -1;
+        }
+        if (dots[2] != '\0') {
+            c->max = strtod(dots + 2, &end);
+            if (*end != '\0') return -1;
+        }
+        c->op = COND_RANGO;
+    }
+    return 0;
+}
+
+// Devuelve el indice del filtro compilado para expr (reutiliza uno identico si ya existe),
+// o -1 si la expresion es invalida o la tabla esta llena
+int obtener_filtro(const char* expr) {
+    if (strlen(expr) >= MAX_FILTRO_LEN) return -1;
+
+    int libre = 0;
+    for (int f = 1; f < MAX_FILTROS; ++f) {
+        if (filtros[f].refs > 0) {
+            if (strcmp(filtros[f].expr, expr) == 0) {
+                filtros[f].refs++;
+                return f;
+            }
+        }
+        else if (libre == 0) {
+            libre = f;
+        }
+    }
+    if (libre == 0) {
+        fprintf(stderr, "[broker] Advertencia: tabla de filtros llena.\n");
+        return -1;
+    }
+
+    filtro_t* fl = &filtros[libre];
+    fl->n = 0;
+    for (const char* s = expr; *s != '\0'; ) {
+        size_t len = strcspn(s, ",");
+        if (len > 0) {
+            if (fl->n == MAX_CONDICIONES ||
+                compilar_condicion(s, len, &fl->conds[fl->n]) < 0) {
+                return -1;
+            }
+            fl->n++;
+        }
+        s += len;
+        if (*s == ',') s++;
+    }
+    if (fl->n == 0) return -1;
+
+    strcpy(fl->expr, expr);
+    fl->refs = 1;
+    return libre;
+}
+
+void liberar_filtro(int f) {
+    if (f > 0 && filtros[f].refs > 0) filtros[f].refs--;
+}
+
+// Separa el payload en campos clave=valor (las palabras sin '=' se ignoran)
+int extraer_campos(const char* payload, campo_t* campos, int max) {
+    int n = 0;
+    const char* p = payload;
+    while (*p != '\0' && n < max) {
+        p += strspn(p, " \t\r\n");
+        size_t len = strcspn(p, " \t\r\n");
+        const char* eq = memchr(p, '=', len);
+        if (eq != NULL && eq != p) {
+            campo_t* c = &campos[n++];
+            c->clave = p;
+            c->clave_len = eq - p;
+            c->valor = eq + 1;
+            c->valor_len = len - (eq + 1 - p);
+
+            // el valor numerico se calcula una vez por mensaje, no por filtro
+            char num[MAX_VALOR];
+            char* end;
+            c->es_num = 0;
+            if (c->valor_len > 0 && c->valor_len < sizeof(num)) {
+                memcpy(num, c->valor, c->valor_len);
+                num[c->valor_len] = '\0';
+                c->num = strtod(num, &end);
+                c->es_num = (*end == '\0');
+            }
+        }
+        p += len;
+    }
+    return n;
+}
+
+// 1 si todas las condiciones del filtro se cumplen en algun campo del mensaje
+int evaluar_filtro(const filtro_t* f, const campo_t* campos, int n) {
+    for (int k = 0; k < f->n; ++k) {
+        const condicion_t* c = &f->conds[k];
+        int ok = 0;
+        for (int i = 0; i < n && !ok; ++i) {
+            const campo_t* cp = &campos[i];
+            if (cp->clave_len != c->clave_len ||
+                memcmp(cp->clave, c->clave, c->clave_len) != 0) continue;
+            switch (c->op) {
+            case COND_IGUAL:
+                ok = cp->valor_len == c->valor_len &&
+                    memcmp(cp->valor, c->valor, c->valor_len) == 0;
+                break;
+            case COND_PREFIJO:
+                ok = cp->valor_len >= c->valor_len &&
+                    memcmp(cp->valor, c->valor, c->valor_len) == 0;
+                break;
+            case COND_RANGO:
+                ok = cp->es_num && cp->num >= c->min && cp->num <= c->max;
+                break;
+            }
+        }
+        if (!ok) return 0;
+    }
+    return 1;
+}
+
 // Compara dos sockaddr_in (ip y puerto) */
 int same_addr(const struct sockaddr_in* a, const struct sockaddr_in* b) {
     return (a->sin_family == b->sin_family) &&
@@ -32,13 +298,157 @@ int same_addr(const struct sockaddr_in* a, const struct sockaddr_in* b) {
         (a->sin_port == b->sin_port);
 }
 
-// Aade un subscriber (si no existe ya) */
-void add_subscriber(const struct sockaddr_in* addr, const char* topic) {
+/* Compresion
+ * Los subscribers que negocian compresion reciben frames "<cabecera>\n<datos>":
+ *   RAW <len>                      sin comprimir (comprimir no ahorraba bytes)
+ *   LZ4 <rawlen> <len>             bloque lz4
+ *   ZST <dict_id> <rawlen> <len>   frame zstd, dict_id 0 = sin diccionario
+ *   DIC <dict_id> <len>            diccionario zstd del topic
+ * Cada frame se arma una sola vez por mensaje y se reenvia igual a todos los
+ * subscribers con el mismo codec. */
+
+double ahora_seg(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Un topic se puede reemplazar si no tiene cola, ni subscribers, ni actividad reciente
+int topic_inactivo(const topic_t* t, double ahora) {
+    if (t->cola_n > 0 || ahora - t->cubeta.ultimo < INACTIVO_SEG) return 0;
+    for (int i = 0; i < MAX_SUBSCRIBERS; ++i) {
+        if (subscribers[i].used && strcmp(subscribers[i].topic, t->name) == 0) return 0;
+    }
+    return 1;
+}
+
+// Busca el estado de un topic; si crear != 0 lo da de alta cuando no existe.
+// Con la tabla llena reutiliza un topic inactivo; NULL si no hay ninguno
+topic_t* get_topic(const char* name, int crear) {
+    topic_t* libre = NULL;
+    for (int t = 0; t < MAX_TOPICS; ++t) {
+        if (topics[t].used) {
+            if (strcmp(topics[t].name, name) == 0) return &topics[t];
+        }
+        else if (libre == NULL) {
+            libre = &topics[t];
+        }
+    }
+    if (!crear) return NULL;
+    if (libre == NULL) {
+        double ahora = ahora_seg();
+        for (int t = 0; t < MAX_TOPICS && libre == NULL; ++t) {
+            if (topic_inactivo(&topics[t], ahora)) libre = &topics[t];
+        }
+        if (libre == NULL) return NULL;
+        printf("[broker] Topic inactivo '%s' reemplazado por '%s'\n", libre->name, name);
+        ZSTD_freeCDict(libre->cdict);
+    }
+    memset(libre, 0, sizeof(*libre));
+    strncpy(libre->name, name, MAX_TOPIC_LEN - 1);
+    libre->used = 1;
+    return libre;
+}
+
+// Arma un frame con cabecera y datos ya comprimidos (o crudos); devuelve su tamano
+size_t armar_frame(char* out, const char* cabecera, const char* datos, size_t len) {
+    size_t h = strlen(cabecera);
+    memcpy(out, cabecera, h);
+    memcpy(out + h, datos, len);
+    return h + len;
+}
+
+// Comprime msg con el codec dado; si no se ahorran bytes se manda como RAW
+size_t comprimir_frame(char* out, int codec, const topic_t* t, const char* msg, size_t len) {
+    char comp[BUF_SIZE];
+    char cabecera[64];
+    size_t clen = 0;
+
+    // capacidad len - 1: si no cabe, comprimir no vale la pena
+    if (codec == CODEC_LZ4) {
+        int r = LZ4_compress_default(msg, comp, (int)len, (int)len - 1);
+        if (r > 0) clen = r;
+        snprintf(cabecera, sizeof(cabecera), "LZ4 %zu %zu\n", len, clen);
+    }
+    else {
+        if (zstd_cctx == NULL) zstd_cctx = ZSTD_createCCtx();
+        size_t r = (t != NULL && t->cdict != NULL)
+            ? ZSTD_compress_usingCDict(zstd_cctx, comp, len - 1, msg, len, t->cdict)
+            : ZSTD_compressCCtx(zstd_cctx, comp, len - 1, msg, len, ZSTD_NIVEL);
+        if (!ZSTD_isError(r)) clen = r;
+        snprintf(cabecera, sizeof(cabecera), "ZST %u %zu %zu\n",
+            t != NULL ? t->dict_id : 0, len, clen);
+    }
+
+    if (clen == 0) {
+        snprintf(cabecera, sizeof(cabecera), "RAW %zu\n", len);
+        return armar_frame(out, cabecera, msg, len);
+    }
+    return armar_frame(out, cabecera, comp, clen);
+}
+
+void enviar_diccionario(int sockfd, const topic_t* t, const struct sockaddr_in* addr) {
+    char frame[FRAME_SIZE];
+    char cabecera[64];
+    snprintf(cabecera, sizeof(cabecera), "DIC %u %zu\n", t->dict_id, t->dict_len);
+    size_t n = armar_frame(frame, cabecera, t->dict, t->dict_len);
+    if (sendto(sockfd, frame, n, 0, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        perror("[broker] sendto DIC");
+    }
+}
+
+// Guarda msg como muestra del topic y, cuando hay suficientes, entrena su diccionario
+// zstd y se lo manda a los subscribers zstd del topic
+void muestrear(int sockfd, topic_t* t, const char* msg, size_t len) {
+    if (t->cdict != NULL) return;
+
+    if (t->n_muestras < MUESTRAS_DICT && t->muestras_usado + len <= MUESTRAS_SIZE) {
+        memcpy(t->muestras + t->muestras_usado, msg, len);
+        t->muestras_usado += len;
+        t->muestra_len[t->n_muestras++] = len;
+        if (t->n_muestras < MUESTRAS_DICT) return;
+    }
+
+    size_t r = ZDICT_trainFromBuffer(t->dict, DICT_CAP, t->muestras,
+        t->muestra_len, (unsigned)t->n_muestras);
+    t->n_muestras = 0;
+    t->muestras_usado = 0;
+    if (ZDICT_isError(r)) {
+        // se vuelve a intentar con el siguiente lote de muestras
+        fprintf(stderr, "[broker] No se pudo entrenar diccionario para '%s': %s\n",
+            t->name, ZDICT_getErrorName(r));
+        return;
+    }
+    t->dict_len = r;
+    t->cdict = ZSTD_createCDict(t->dict, t->dict_len, ZSTD_NIVEL);
+    t->dict_id = ++ultimo_dict_id;
+    printf("[broker] Diccionario zstd %u para topic '%s' (%zu bytes)\n",
+        t->dict_id, t->name, t->dict_len);
+
+    for (int i = 0; i < MAX_SUBSCRIBERS; ++i) {
+        if (subscribers[i].used && subscribers[i].codec == CODEC_ZSTD &&
+            strcmp(subscribers[i].topic, t->name) == 0) {
+            enviar_diccionario(sockfd, t, &subscribers[i].addr);
+        }
+    }
+}
+
+// Aade un subscriber (si no existe ya); el filtro pasa a ser del subscriber */
+void add_subscriber(int sockfd, const struct sockaddr_in* addr, const char* topic,
+    int filtro, int codec) {
+    // un subscriber zstd necesita el diccionario vigente del topic (tambien al re-suscribirse,
+    // que es como pide uno que se perdio)
+    topic_t* t = (codec == CODEC_ZSTD) ? get_topic(topic, 1) : NULL;
+    if (t != NULL && t->cdict != NULL) enviar_diccionario(sockfd, t, addr);
+
     for (int i = 0; i < MAX_SUBSCRIBERS; ++i) {
         if (subscribers[i].used) {
             if (strcmp(subscribers[i].topic, topic) == 0 &&
                 same_addr(&subscribers[i].addr, addr)) {
-                // ya registrado
+                // ya registrado: solo se actualizan filtro y codec
+                liberar_filtro(subscribers[i].filtro);
+                subscribers[i].filtro = filtro;
+                subscribers[i].codec = codec;
                 return;
             }
         }
@@ -46,24 +456,69 @@ void add_subscriber(const struct sockaddr_in* addr, const char* topic) {
             // usar este slot libre
             subscribers[i].used = 1;
             subscribers[i].addr = *addr;
+            subscribers[i].filtro = filtro;
+            subscribers[i].codec = codec;
             strncpy(subscribers[i].topic, topic, MAX_TOPIC_LEN - 1);
             subscribers[i].topic[MAX_TOPIC_LEN - 1] = '\0';
             char ipstr[INET_ADDRSTRLEN];
             inet_ntop(AF_INET, &addr->sin_addr, ipstr, sizeof(ipstr));
-            printf("[broker] Nuevo subscriber %s:%d para topic '%s'\n",
-                ipstr, ntohs(addr->sin_port), subscribers[i].topic);
+            printf("[broker] Nuevo subscriber %s:%d para topic '%s' filtro='%s'\n",
+                ipstr, ntohs(addr->sin_port), subscribers[i].topic,
+                filtro ? filtros[filtro].expr : "");
             return;
         }
     }
+    liberar_filtro(filtro);
     fprintf(stderr, "[broker] Advertencia: lista de subscribers llena, no se puede agregar ms.\n");
 }
 
-/* Enva payload a todos los subscribers del topic */
-void forward_to_topic(int sockfd, const char* topic, const char* payload) {
+/* Enva payload a todos los subscribers del topic cuyo filtro lo acepte.
+ * Si el publisher lo mando en lz4, lz4_bloque es ese bloque y se reenvia tal cual. */
+void forward_to_topic(int sockfd, const char* topic, const char* payload,
+    const char* lz4_bloque, size_t lz4_len) {
+    size_t payload_len = strlen(payload);
+    char frames[3][FRAME_SIZE];        // un frame por codec, armado a lo sumo una vez
+    size_t frame_len[3] = { 0, 0, 0 };
+    topic_t* t = NULL;
+    int hay_zstd = 0;
+    campo_t campos[MAX_CAMPOS];
+    int n_campos = -1;                 // el payload se analiza solo si algun subscriber filtra
+    signed char resultado[MAX_FILTROS]; // -1 = filtro aun no evaluado para este mensaje
+    memset(resultado, -1, sizeof(resultado));
+
     for (int i = 0; i < MAX_SUBSCRIBERS; ++i) {
         if (!subscribers[i].used) continue;
         if (strcmp(subscribers[i].topic, topic) == 0) {
-            ssize_t sent = sendto(sockfd, payload, strlen(payload), 0,
+            int f = subscribers[i].filtro;
+            if (f != 0) {
+                if (resultado[f] < 0) {
+                    if (n_campos < 0) n_campos = extraer_campos(payload, campos, MAX_CAMPOS);
+                    resultado[f] = evaluar_filtro(&filtros[f], campos, n_campos);
+                }
+                if (!resultado[f]) continue;
+            }
+
+            int codec = subscribers[i].codec;
+            const char* datos = payload;
+            size_t datos_len = payload_len;
+            if (codec != CODEC_NINGUNO) {
+                if (frame_len[codec] == 0) {
+                    if (codec == CODEC_LZ4 && lz4_bloque != NULL) {
+                        char cabecera[64];
+                        snprintf(cabecera, sizeof(cabecera), "LZ4 %zu %zu\n", payload_len, lz4_len);
+                        frame_len[codec] = armar_frame(frames[codec], cabecera, lz4_bloque, lz4_len);
+                    }
+                    else {
+                        if (codec == CODEC_ZSTD) t = get_topic(topic, 1);
+                        frame_len[codec] = comprimir_frame(frames[codec], codec, t, payload, payload_len);
+                    }
+                }
+                datos = frames[codec];
+                datos_len = frame_len[codec];
+                if (codec == CODEC_ZSTD) hay_zstd = 1;
+            }
+
+            ssize_t sent = sendto(sockfd, datos, datos_len, 0,
                 (struct sockaddr*)&subscribers[i].addr,
                 sizeof(subscribers[i].addr));
             if (sent < 0) {
@@ -77,6 +532,197 @@ void forward_to_topic(int sockfd, const char* topic, const char* payload) {
             }
         }
     }
+
+    // el diccionario solo se entrena para topics que tienen subscribers zstd
+    if (hay_zstd && t != NULL) muestrear(sockfd, t, payload, payload_len);
+}
+
+/* Decodifica un datagrama PUB/PUBZ (terminado en '\0') y lo reenvia al topic */
+void procesar_publicacion(int sockfd, char* buf, size_t len) {
+    if (strncmp(buf, "PUBZ ", 5) == 0) {
+        // PUBZ <topic> <rawlen>\n<bloque lz4>: el publisher ya comprimio el payload
+        char topic[MAX_TOPIC_LEN];
+        size_t rawlen;
+        char payload[BUF_SIZE];
+        char* nl = memchr(buf, '\n', len);
+        if (nl != NULL && sscanf(buf + 5, "%127s %zu", topic, &rawlen) == 2 &&
+            rawlen > 0 && rawlen < BUF_SIZE) {
+            // se descomprime una sola vez (filtros y subscribers sin lz4);
+            // a los subscribers lz4 les llega el bloque original
+            const char* bloque = nl + 1;
+            size_t bloque_len = len - (bloque - buf);
+            int r = LZ4_decompress_safe(bloque, payload, (int)bloque_len, BUF_SIZE - 1);
+            if (r == (int)rawlen && memchr(payload, '\0', rawlen) == NULL) {
+                payload[r] = '\0';
+                forward_to_topic(sockfd, topic, payload, bloque, bloque_len);
+            }
+            else {
+                fprintf(stderr, "[broker] PUBZ con bloque lz4 invalido\n");
+            }
+        }
+        else {
+            fprintf(stderr, "[broker] PUBZ invlido\n");
+        }
+        return;
+    }
+
+    // PUB <topic> <payload...>
+    char topic[MAX_TOPIC_LEN];
+    // buscamos primer espacio despus del topic
+    char* p = buf + 4;
+    if (sscanf(p, "%127s", topic) >= 1) {
+        // Avanzamos p hasta despus del topic
+        p += strlen(topic);
+        while (*p == ' ') p++;
+        const char* payload = p;
+        if (*payload == '\0') {
+            fprintf(stderr, "[broker] PUB sin payload\n");
+        }
+        else {
+            // reenviar payload tal cual a los suscriptores del topic
+            forward_to_topic(sockfd, topic, payload, NULL, 0);
+        }
+    }
+    else {
+        fprintf(stderr, "[broker] PUB invlido: '%s'\n", buf);
+    }
+}
+
+/* Limites de tasa y planificacion
+ * Cada publisher y cada topic tienen una cubeta de tokens. Un datagrama de un
+ * publisher sin tokens se descarta al llegar (UDP no permite frenar al emisor);
+ * los admitidos esperan en la cola de su topic, y con la cola llena tambien se
+ * descartan para no frenar a los demas topics que comparten el socket. Las colas se atienden con
+ * deficit round robin: en cada ronda un topic gana QUANTUM bytes y envia mientras
+ * le alcance el deficit y tenga tokens, asi un topic ruidoso no retrasa mas de
+ * una ronda a los topics tranquilos. */
+
+void recargar(cubeta_t* c, double tasa, double ahora) {
+    double max = tasa * RAFAGA_SEG < 1.0 ? 1.0 : tasa * RAFAGA_SEG;
+    c->tokens = (c->ultimo == 0) ? max : c->tokens + (ahora - c->ultimo) * tasa;
+    if (c->tokens > max) c->tokens = max;
+    c->ultimo = ahora;
+}
+
+// Busca (o da de alta) el publisher con esa direccion. Con la tabla llena reemplaza
+// al que lleva mas tiempo sin publicar si supera INACTIVO_SEG; si no, NULL
+publisher_t* get_publisher(const struct sockaddr_in* addr) {
+    publisher_t* libre = NULL;
+    publisher_t* viejo = NULL;
+    for (int i = 0; i < MAX_PUBLISHERS; ++i) {
+        if (publishers[i].used) {
+            if (same_addr(&publishers[i].addr, addr)) return &publishers[i];
+            if (viejo == NULL || publishers[i].cubeta.ultimo < viejo->cubeta.ultimo) viejo = &publishers[i];
+        }
+        else if (libre == NULL) {
+            libre = &publishers[i];
+        }
+    }
+    if (libre == NULL && viejo != NULL && ahora_seg() - viejo->cubeta.ultimo >= INACTIVO_SEG)
+        libre = viejo;
+    if (libre != NULL) {
+        memset(libre, 0, sizeof(*libre));
+        libre->addr = *addr;
+        libre->used = 1;
+    }
+    return libre;
+}
+
+/* Aplica el limite del publisher y deja el datagrama en la cola de su topic */
+void encolar_publicacion(char* buf, size_t len, const struct sockaddr_in* src) {
+    char topic[MAX_TOPIC_LEN];
+    if (sscanf(buf + (buf[3] == 'Z' ? 5 : 4), "%127s", topic) != 1) {
+        fprintf(stderr, "[broker] PUB invlido: '%s'\n", buf);
+        return;
+    }
+    hubo_actividad = 1;
+
+    // sin lugar para el publisher no se puede aplicar su limite: se descarta
+    publisher_t* pub = get_publisher(src);
+    if (pub == NULL) {
+        sin_publisher++;
+        return;
+    }
+    recargar(&pub->cubeta, tasa_publisher, ahora_seg());
+    if (pub->cubeta.tokens < 1) {
+        pub->limitados++;
+        return;
+    }
+
+    topic_t* t = get_topic(topic, 1);
+    if (t == NULL || t->cola_n == COLA_LEN) {
+        // sin cola disponible el datagrama se descarta sin gastar tokens del publisher
+        if (t != NULL) t->descartados++;
+        pub->descartados++;
+        return;
+    }
+    pub->cubeta.tokens -= 1;
+    pub->admitidos++;
+
+    int k = (t->cola_ini + t->cola_n) % COLA_LEN;
+    memcpy(t->cola[k], buf, len + 1);
+    t->cola_len[k] = len;
+    t->cola_n++;
+}
+
+int hay_pendientes(void) {
+    for (int t = 0; t < MAX_TOPICS; ++t) {
+        if (topics[t].used && topics[t].cola_n > 0) return 1;
+    }
+    return 0;
+}
+
+/* Una ronda de deficit round robin sobre las colas de los topics */
+void servir_colas(int sockfd) {
+    double ahora = ahora_seg();
+    for (int k = 0; k < MAX_TOPICS; ++k) {
+        topic_t* t = &topics[(drr_inicio + k) % MAX_TOPICS];
+        if (!t->used || t->cola_n == 0) continue;
+
+        recargar(&t->cubeta, tasa_topic, ahora);
+        if (t->cubeta.tokens < 1) {
+            // el topic supero su tasa: pierde la ronda sin acumular deficit
+            t->rondas_sin_tokens++;
+            continue;
+        }
+        t->deficit += QUANTUM;
+        while (t->cola_n > 0 && (long)t->cola_len[t->cola_ini] <= t->deficit &&
+            t->cubeta.tokens >= 1) {
+            char buf[BUF_SIZE];
+            size_t len = t->cola_len[t->cola_ini];
+            memcpy(buf, t->cola[t->cola_ini], len + 1);
+            t->cola_ini = (t->cola_ini + 1) % COLA_LEN;
+            t->cola_n--;
+            t->deficit -= len;
+            t->cubeta.tokens -= 1;
+            t->servidos++;
+            procesar_publicacion(sockfd, buf, len);
+        }
+        // una cola vacia no guarda deficit para la ronda siguiente
+        if (t->cola_n == 0) t->deficit = 0;
+    }
+    drr_inicio = (drr_inicio + 1) % MAX_TOPICS;
+}
+
+void imprimir_estadisticas(void) {
+    printf("[broker] --- Estadisticas (limites: %.1f msgs/s por publisher, %.1f msgs/s por topic) ---\n",
+        tasa_publisher, tasa_topic);
+    for (int i = 0; i < MAX_PUBLISHERS; ++i) {
+        if (!publishers[i].used) continue;
+        char ipstr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &publishers[i].addr.sin_addr, ipstr, sizeof(ipstr));
+        printf("[broker]   publisher %s:%d admitidos=%lu limitados=%lu descartados=%lu\n",
+            ipstr, ntohs(publishers[i].addr.sin_port),
+            publishers[i].admitidos, publishers[i].limitados, publishers[i].descartados);
+    }
+    if (sin_publisher > 0)
+        printf("[broker]   descartados sin lugar en la tabla de publishers=%lu\n", sin_publisher);
+    for (int t = 0; t < MAX_TOPICS; ++t) {
+        if (!topics[t].used) continue;
+        printf("[broker]   topic '%s' servidos=%lu en_cola=%d descartados=%lu rondas_sin_tokens=%lu\n",
+            topics[t].name, topics[t].servidos, topics[t].cola_n,
+            topics[t].descartados, topics[t].rondas_sin_tokens);
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -87,6 +733,14 @@ int main(int argc, char* argv[]) {
     int maxfd;
     struct timeval tv;
 
+    // limites opcionales: msgs/s por publisher y por topic
+    if (argc >= 2) tasa_publisher = atof(argv[1]);
+    if (argc >= 3) tasa_topic = atof(argv[2]);
+    if (tasa_publisher <= 0 || tasa_topic <= 0) {
+        fprintf(stderr, "Uso: %s [msgs/s por publisher] [msgs/s por topic]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
     // inicializar lista de subscribers
     memset(subscribers, 0, sizeof(subscribers));
 
@@ -107,69 +761,63 @@ int main(int argc, char* argv[]) {
     }
 
     printf("[broker] Escuchando UDP en 0.0.0.0:%d\n", BROKER_PORT);
+    double proximas_estadisticas = ahora_seg() + ESTADISTICAS_SEG;
 
     while (1) {
         FD_ZERO(&readfds);
         FD_SET(sockfd, &readfds);
         maxfd = sockfd;
 
-        // opcionalmente podemos usar timeout para tareas peridicas; aqu bloqueamos hasta evento
-        tv.tv_sec = 5;
-        tv.tv_usec = 0;
+        // con publicaciones en cola solo se espera lo justo para que se recarguen las cubetas;
+        // si no, el timeout sirve para las estadisticas periodicas
+        int pendientes = hay_pendientes();
+        tv.tv_sec = pendientes ? 0 : 1;
+        tv.tv_usec = pendientes ? ESPERA_COLAS_US : 0;
 
         int rv = select(maxfd + 1, &readfds, NULL, NULL, &tv);
         if (rv < 0) {
             perror("[broker] select");
             break;
         }
-        else if (rv == 0) {
-            // timeout: no hay datos; continue (podramos hacer limpieza peridica si fuera necesario)
-            continue;
-        }
 
-        if (FD_ISSET(sockfd, &readfds)) {
+        // se leen hasta LOTE_RECV datagramas sin bloquear; despues se atienden las colas
+        for (int n = 0; rv > 0 && n < LOTE_RECV; ++n) {
             struct sockaddr_in src_addr;
             socklen_t addrlen = sizeof(src_addr);
-            ssize_t len = recvfrom(sockfd, buf, BUF_SIZE - 1, 0,
+            ssize_t len = recvfrom(sockfd, buf, BUF_SIZE - 1, MSG_DONTWAIT,
                 (struct sockaddr*)&src_addr, &addrlen);
             if (len < 0) {
-                perror("[broker] recvfrom");
-                continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) perror("[broker] recvfrom");
+                break;
             }
             buf[len] = '\0';
 
-            // Decodificar mensaje: esperamos inicio con "SUB " o "PUB "
+            // Decodificar mensaje: esperamos inicio con "SUB ", "PUB " o "PUBZ "
             if (len >= 4 && strncmp(buf, "SUB ", 4) == 0) {
-                // SUB <topic>
+                // SUB <topic> [filtro] [@lz4|@zstd]
                 char topic[MAX_TOPIC_LEN];
-                if (sscanf(buf + 4, "%127s", topic) == 1) {
-                    add_subscriber(&src_addr, topic);
+                char opts[2][MAX_FILTRO_LEN];
+                int n = sscanf(buf + 4, "%127s %255s %255s", topic, opts[0], opts[1]);
+                int filtro = 0;
+                int codec = CODEC_NINGUNO;
+                int ok = (n >= 1);
+                for (int k = 0; k + 1 < n && ok; ++k) {
+                    if (strcmp(opts[k], "@lz4") == 0) codec = CODEC_LZ4;
+                    else if (strcmp(opts[k], "@zstd") == 0) codec = CODEC_ZSTD;
+                    else if (opts[k][0] == '@' || filtro != 0) ok = 0;
+                    else if ((filtro = obtener_filtro(opts[k])) < 0) ok = 0;
+                }
+                if (ok) {
+                    add_subscriber(sockfd, &src_addr, topic, filtro, codec);
                 }
                 else {
+                    liberar_filtro(filtro);
                     fprintf(stderr, "[broker] SUB invlido: '%s'\n", buf);
                 }
             }
-            else if (len >= 4 && strncmp(buf, "PUB ", 4) == 0) {
-                // PUB <topic> <payload...>
-                char topic[MAX_TOPIC_LEN];
-                // buscamos primer espacio despus del topic
-                char* p = buf + 4;
-                if (sscanf(p, "%127s", topic) >= 1) {
-                    // Avanzamos p hasta despus del topic
-                    p += strlen(topic);
-                    while (*p == ' ') p++;
-                    const char* payload = p;
-                    if (*payload == '\0') {
-                        fprintf(stderr, "[broker] PUB sin payload\n");
-                    }
-                    else {
-                        // reenviar payload tal cual a los suscriptores del topic
-                        forward_to_topic(sockfd, topic, payload);
-                    }
-                }
-                else {
-                    fprintf(stderr, "[broker] PUB invlido: '%s'\n", buf);
-                }
+            else if ((len >= 5 && strncmp(buf, "PUBZ ", 5) == 0) ||
+                (len >= 4 && strncmp(buf, "PUB ", 4) == 0)) {
+                encolar_publicacion(buf, len, &src_addr);
             }
             else {
                 // Mensaje desconocido: ignorar o logear
@@ -179,6 +827,14 @@ int main(int argc, char* argv[]) {
                     ipstr, ntohs(src_addr.sin_port), buf);
             }
         }
+
+        servir_colas(sockfd);
+
+        if (ahora_seg() >= proximas_estadisticas) {
+            if (hubo_actividad) imprimir_estadisticas();
+            hubo_actividad = 0;
+            proximas_estadisticas = ahora_seg() + ESTADISTICAS_SEG;
+        }
     }
 
     close(sockfd);
@@ -1,6 +1,7 @@
 
-//     gcc publisher_udp.c -o publisher_udp
-//     ./publisher_udp <topic> [broker_ip] [broker_port]
+//     gcc publisher_udp.c -o publisher_udp -llz4
+//     ./publisher_udp <topic> [broker_ip] [broker_port] [lz4]
+//     lz4: los mensajes viajan comprimidos y el broker los reenvía sin recomprimir
 
 
 #include <stdio.h>
@@ -10,6 +11,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <lz4.h>
 
 #define DEFAULT_BROKER_IP "127.0.0.1"   // ip del broker por defecto (localhost)
 #define DEFAULT_BROKER_PORT 5000        // puerto del broker pr defecto
@@ -18,7 +20,7 @@
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         // si no se pone al menos el topic, muestra como se usa y sale
-        fprintf(stderr, "Uso: %s <topic> [broker_ip] [broker_port]\n", argv[0]);
+        fprintf(stderr, "Uso: %s <topic> [broker_ip] [broker_port] [lz4]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -28,6 +30,8 @@ int main(int argc, char* argv[]) {
     const char* broker_ip = (argc >= 3) ? argv[2] : DEFAULT_BROKER_IP;
     // si el usurio pone puerto lo usa, sino 5000
     int broker_port = (argc >= 4) ? atoi(argv[3]) : DEFAULT_BROKER_PORT;
+    // si se pone "lz4" los mensajes se mandan comprimidos
+    int usar_lz4 = (argc >= 5) && strcmp(argv[4], "lz4") == 0;
 
     int sockfd;                         // descriptor del socket (como un id)
     struct sockaddr_in broker_addr;     // estrctura con la info del broker
@@ -63,9 +67,24 @@ int main(int argc, char* argv[]) {
         // arma el mensaje completo que se mandaar al broker
         // ej: "PUB partido1 gol del equipo A"
         snprintf(out, sizeof(out), "PUB %s %s", topic, line);
+        size_t out_len = strlen(out);
+
+        // con lz4 se manda "PUBZ <topic> <largo>\n<bloque lz4>", solo si ocupa menos que el texto
+        if (usar_lz4) {
+            char comp[BUF_SIZE];
+            size_t L = strlen(line);
+            int c = LZ4_compress_default(line, comp, (int)L, (int)L - 1);
+            char cab[BUF_SIZE];
+            int h = snprintf(cab, sizeof(cab), "PUBZ %s %zu\n", topic, L);
+            if (c > 0 && (size_t)(h + c) <= sizeof(out)) {
+                memcpy(out, cab, h);
+                memcpy(out + h, comp, c);
+                out_len = h + c;
+            }
+        }
 
         // envia el mensaje al broker usando UDP
-        ssize_t sent = sendto(sockfd, out, strlen(out), 0,
+        ssize_t sent = sendto(sockfd, out, out_len, 0,
             (struct sockaddr*)&broker_addr, sizeof(broker_addr));
 
         if (sent < 0) {
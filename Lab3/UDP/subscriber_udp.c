@@ -1,5 +1,7 @@
-//   gcc subscriber_udp.c -o subscriber_udp
-//   ./subscriber_udp <topic> [broker_ip] [broker_port]
+//   gcc subscriber_udp.c -o subscriber_udp -llz4 -lzstd
+//   ./subscriber_udp <topic> [broker_ip] [broker_port] [filtro|-] [lz4|zstd]
+//   ej filtro: ciudad=lima,temp=10..30,equipo^=real  (el broker solo reenvía lo que cumple)
+//   lz4/zstd: pide al broker que mande los mensajes comprimidos
 
 
 #include <stdio.h>
@@ -9,25 +11,83 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <time.h>
+#include <lz4.h>
+#include <zstd.h>
 
 #define DEFAULT_BROKER_IP "127.0.0.1"   // ip por defecto del broker (localhost)
 #define DEFAULT_BROKER_PORT 5000        // puerto por defecto del broker
 #define BUF_SIZE 2048                   // tamaño del buffer
+#define FRAME_SIZE (BUF_SIZE + 64)      // mensaje + cabecera del frame comprimido
+#define DICT_CAP 1024                   // tamaño max del diccionario zstd que manda el broker
+#define ESPERA_DIC_SEG 2                // tras pedir el diccionario se espera esto antes de volver a pedirlo
+
+// diccionario zstd vigente del topic (lo manda el broker en un frame DIC).
+// se carga una sola vez en un ZSTD_DDict y se reutiliza para todos los frames
+ZSTD_DDict *ddict = NULL;
+unsigned dict_id = 0;
+
+// decodifica un frame del broker ("<cabecera>\n<datos>") y deja el mensaje en out.
+// devuelve el largo del mensaje, 0 si era un diccionario, -1 si el frame es invalido
+// y -2 si viene con un diccionario que no tenemos
+int decodificar_frame(const char *frame, size_t len, char *out, size_t out_cap) {
+    static ZSTD_DCtx *dctx = NULL;
+    const char *nl = memchr(frame, '\n', len);
+    if (nl == NULL) return -1;
+    const char *datos = nl + 1;
+    size_t datos_len = len - (datos - frame);
+    size_t rawlen, n;
+    unsigned id;
+
+    if (sscanf(frame, "RAW %zu", &n) == 1 && n == datos_len && n < out_cap) {
+        memcpy(out, datos, n);
+        return (int)n;
+    }
+    if (sscanf(frame, "LZ4 %zu %zu", &rawlen, &n) == 2 && n == datos_len && rawlen < out_cap) {
+        int r = LZ4_decompress_safe(datos, out, (int)n, (int)out_cap - 1);
+        return (r == (int)rawlen) ? r : -1;
+    }
+    if (sscanf(frame, "ZST %u %zu %zu", &id, &rawlen, &n) == 3 && n == datos_len && rawlen < out_cap) {
+        if (id != 0 && id != dict_id) return -2;
+        if (dctx == NULL) dctx = ZSTD_createDCtx();
+        size_t r = (id != 0)
+            ? ZSTD_decompress_usingDDict(dctx, out, out_cap - 1, datos, n, ddict)
+            : ZSTD_decompressDCtx(dctx, out, out_cap - 1, datos, n);
+        return (!ZSTD_isError(r) && r == rawlen) ? (int)r : -1;
+    }
+    if (sscanf(frame, "DIC %u %zu", &id, &n) == 2 && n == datos_len && n <= DICT_CAP) {
+        ZSTD_freeDDict(ddict);
+        ddict = ZSTD_createDDict(datos, n);
+        dict_id = (ddict != NULL) ? id : 0;
+        if (ddict == NULL) return -1;
+        printf("[subscriber] Recibido diccionario zstd %u (%zu bytes)\n", id, n);
+        return 0;
+    }
+    return -1;
+}
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         // si no se pasa el topic, muestra como usar el programa
-        fprintf(stderr, "Uso: %s <topic> [broker_ip] [broker_port]\n", argv[0]);
+        fprintf(stderr, "Uso: %s <topic> [broker_ip] [broker_port] [filtro|-] [lz4|zstd]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
     const char *topic = argv[1];   // el primer argumento es el topic
     const char *broker_ip = (argc >= 3) ? argv[2] : DEFAULT_BROKER_IP; // ip del broker (si no se pasa usa la por defecto)
     int broker_port = (argc >= 4) ? atoi(argv[3]) : DEFAULT_BROKER_PORT; // puerto del broker
+    const char *filtro = (argc >= 5 && strcmp(argv[4], "-") != 0) ? argv[4] : NULL; // filtro de contenido opcional (lo evalúa el broker)
+    const char *codec = (argc >= 6) ? argv[5] : NULL; // compresion pedida al broker (lz4 o zstd)
+    if (codec != NULL && strcmp(codec, "lz4") != 0 && strcmp(codec, "zstd") != 0) {
+        fprintf(stderr, "Compresion desconocida '%s' (usa lz4 o zstd)\n", codec);
+        exit(EXIT_FAILURE);
+    }
 
     int sockfd;                      // descriptor del socket
     struct sockaddr_in local_addr, broker_addr;  // direcciones local y del broker
-    char buf[BUF_SIZE];              // buffer pra los mensajes que se reciban
+    char buf[FRAME_SIZE];            // buffer pra los mensajes (o frames) que se reciban
+    char texto[BUF_SIZE];            // mensaje ya descomprimido
+    time_t dic_pedido = 0;           // cuando se pidio el diccionario por ultima vez (0 = no hay pedido)
 
     // crear socket udp (SOCK_DGRAM). si da error se sale
     if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
@@ -65,9 +125,12 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // enviar el mensaje SUB al broker para suscribirse al topic
+    // enviar el mensaje SUB al broker para suscribirse al topic (con filtro y compresion si hay)
+    // ej: "SUB partido1 equipo^=real @zstd"
     char msg[BUF_SIZE];
-    snprintf(msg, sizeof(msg), "SUB %s", topic);
+    snprintf(msg, sizeof(msg), "SUB %s%s%s%s%s", topic,
+             filtro ? " " : "", filtro ? filtro : "",
+             codec ? " @" : "", codec ? codec : "");
     ssize_t sent = sendto(sockfd, msg, strlen(msg), 0,
                           (struct sockaddr*)&broker_addr, sizeof(broker_addr));
     if (sent < 0) {
@@ -96,12 +159,39 @@ int main(int argc, char *argv[]) {
 
         buf[r] = '\0';  // se añade el fin de cadena al mensaje recibido
 
+        // con compresion el broker manda frames: hay que decodificarlos
+        const char *mensaje = buf;
+        if (codec != NULL) {
+            int n = decodificar_frame(buf, r, texto, sizeof(texto));
+            if (n == -2) {
+                // falta el diccionario (se perdio el DIC): re-suscribirse hace que el broker lo reenvie.
+                // se pide una sola vez y se espera el DIC; cada SUB le cuesta al broker un datagrama de 1 KB
+                time_t ahora = time(NULL);
+                if (dic_pedido == 0 || ahora - dic_pedido >= ESPERA_DIC_SEG) {
+                    printf("[subscriber] Diccionario desconocido, se pide de nuevo al broker\n");
+                    sendto(sockfd, msg, strlen(msg), 0, (struct sockaddr*)&broker_addr, sizeof(broker_addr));
+                    dic_pedido = ahora;
+                }
+                continue;
+            }
+            if (n < 0) {
+                fprintf(stderr, "[subscriber] Frame invalido (%zd bytes)\n", r);
+                continue;
+            }
+            if (n == 0) {
+                dic_pedido = 0;    // era un diccionario
+                continue;
+            }
+            texto[n] = '\0';
+            mensaje = texto;
+        }
+
         // convierte la ip dl remitente a texto
         char srcip[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &src.sin_addr, srcip, sizeof(srcip));
 
-        // muestra el mensaje recibido por consola
-        printf("[subscriber] Mensaje desde %s:%d -> %s\n", srcip, ntohs(src.sin_port), buf);
+        // muestra el mensaje recibido por consola (y cuanto ocupo en la red)
+        printf("[subscriber] Mensaje desde %s:%d (%zd bytes) -> %s\n", srcip, ntohs(src.sin_port), r, mensaje);
     }
 
     // aunque este punto nunca se alcanza, por buena practica se cierra el socket